@@ -168,6 +168,11 @@ static int	input_dcs_dispatch(struct input_ctx *);
 static int	input_top_bit_set(struct input_ctx *);
 static int	input_end_bel(struct input_ctx *);
 
+/* Ground state fast paths for printable text. */
+static size_t	input_printable(const u_char *, size_t);
+static void	input_print_string(struct input_ctx *, const u_char *, size_t);
+static size_t	input_print_utf8(struct input_ctx *, const u_char *, size_t);
+
 /* Command table comparison function. */
 static int	input_table_compare(const void *, const void *);
 
@@ -309,6 +314,7 @@ struct input_state {
 	void				(*enter)(struct input_ctx *);
 	void				(*exit)(struct input_ctx *);
 	const struct input_transition	*transitions;
+	u_char				*lookup; /* transition for each byte */
 };
 
 /* State transitions available from all states. */
@@ -336,123 +342,180 @@ static const struct input_transition input_state_apc_string_table[];
 static const struct input_transition input_state_rename_string_table[];
 static const struct input_transition input_state_consume_st_table[];
 
+/* Transition tables indexed by byte, filled in from the above. */
+static u_char input_state_ground_lookup[256];
+static u_char input_state_esc_enter_lookup[256];
+static u_char input_state_esc_intermediate_lookup[256];
+static u_char input_state_csi_enter_lookup[256];
+static u_char input_state_csi_parameter_lookup[256];
+static u_char input_state_csi_intermediate_lookup[256];
+static u_char input_state_csi_ignore_lookup[256];
+static u_char input_state_dcs_enter_lookup[256];
+static u_char input_state_dcs_parameter_lookup[256];
+static u_char input_state_dcs_intermediate_lookup[256];
+static u_char input_state_dcs_handler_lookup[256];
+static u_char input_state_dcs_escape_lookup[256];
+static u_char input_state_dcs_ignore_lookup[256];
+static u_char input_state_osc_string_lookup[256];
+static u_char input_state_apc_string_lookup[256];
+static u_char input_state_rename_string_lookup[256];
+static u_char input_state_consume_st_lookup[256];
+
 /* ground state definition. */
 static const struct input_state input_state_ground = {
 	"ground",
 	input_ground, NULL,
-	input_state_ground_table
+	input_state_ground_table,
+	input_state_ground_lookup
 };
 
 /* esc_enter state definition. */
 static const struct input_state input_state_esc_enter = {
 	"esc_enter",
 	input_clear, NULL,
-	input_state_esc_enter_table
+	input_state_esc_enter_table,
+	input_state_esc_enter_lookup
 };
 
 /* esc_intermediate state definition. */
 static const struct input_state input_state_esc_intermediate = {
 	"esc_intermediate",
 	NULL, NULL,
-	input_state_esc_intermediate_table
+	input_state_esc_intermediate_table,
+	input_state_esc_intermediate_lookup
 };
 
 /* csi_enter state definition. */
 static const struct input_state input_state_csi_enter = {
 	"csi_enter",
 	input_clear, NULL,
-	input_state_csi_enter_table
+	input_state_csi_enter_table,
+	input_state_csi_enter_lookup
 };
 
 /* csi_parameter state definition. */
 static const struct input_state input_state_csi_parameter = {
 	"csi_parameter",
 	NULL, NULL,
-	input_state_csi_parameter_table
+	input_state_csi_parameter_table,
+	input_state_csi_parameter_lookup
 };
 
 /* csi_intermediate state definition. */
 static const struct input_state input_state_csi_intermediate = {
 	"csi_intermediate",
 	NULL, NULL,
-	input_state_csi_intermediate_table
+	input_state_csi_intermediate_table,
+	input_state_csi_intermediate_lookup
 };
 
 /* csi_ignore state definition. */
 static const struct input_state input_state_csi_ignore = {
 	"csi_ignore",
 	NULL, NULL,
-	input_state_csi_ignore_table
+	input_state_csi_ignore_table,
+	input_state_csi_ignore_lookup
 };
 
 /* dcs_enter state definition. */
 static const struct input_state input_state_dcs_enter = {
 	"dcs_enter",
 	input_enter_dcs, NULL,
-	input_state_dcs_enter_table
+	input_state_dcs_enter_table,
+	input_state_dcs_enter_lookup
 };
 
 /* dcs_parameter state definition. */
 static const struct input_state input_state_dcs_parameter = {
 	"dcs_parameter",
 	NULL, NULL,
-	input_state_dcs_parameter_table
+	input_state_dcs_parameter_table,
+	input_state_dcs_parameter_lookup
 };
 
 /* dcs_intermediate state definition. */
 static const struct input_state input_state_dcs_intermediate = {
 	"dcs_intermediate",
 	NULL, NULL,
-	input_state_dcs_intermediate_table
+	input_state_dcs_intermediate_table,
+	input_state_dcs_intermediate_lookup
 };
 
 /* dcs_handler state definition. */
 static const struct input_state input_state_dcs_handler = {
 	"dcs_handler",
 	NULL, NULL,
-	input_state_dcs_handler_table
+	input_state_dcs_handler_table,
+	input_state_dcs_handler_lookup
 };
 
 /* dcs_escape state definition. */
 static const struct input_state input_state_dcs_escape = {
 	"dcs_escape",
 	NULL, NULL,
-	input_state_dcs_escape_table
+	input_state_dcs_escape_table,
+	input_state_dcs_escape_lookup
 };
 
 /* dcs_ignore state definition. */
 static const struct input_state input_state_dcs_ignore = {
 	"dcs_ignore",
 	NULL, NULL,
-	input_state_dcs_ignore_table
+	input_state_dcs_ignore_table,
+	input_state_dcs_ignore_lookup
 };
 
 /* osc_string state definition. */
 static const struct input_state input_state_osc_string = {
 	"osc_string",
 	input_enter_osc, input_exit_osc,
-	input_state_osc_string_table
+	input_state_osc_string_table,
+	input_state_osc_string_lookup
 };
 
 /* apc_string state definition. */
 static const struct input_state input_state_apc_string = {
 	"apc_string",
 	input_enter_apc, input_exit_apc,
-	input_state_apc_string_table
+	input_state_apc_string_table,
+	input_state_apc_string_lookup
 };
 
 /* rename_string state definition. */
 static const struct input_state input_state_rename_string = {
 	"rename_string",
 	input_enter_rename, input_exit_rename,
-	input_state_rename_string_table
+	input_state_rename_string_table,
+	input_state_rename_string_lookup
 };
 
 /* consume_st state definition. */
 static const struct input_state input_state_consume_st = {
 	"consume_st",
 	input_enter_rename, NULL, /* rename also waits for ST */
-	input_state_consume_st_table
+	input_state_consume_st_table,
+	input_state_consume_st_lookup
+};
+
+/* All states, for building lookup tables. */
+static const struct input_state *input_states[] = {
+	&input_state_ground,
+	&input_state_esc_enter,
+	&input_state_esc_intermediate,
+	&input_state_csi_enter,
+	&input_state_csi_parameter,
+	&input_state_csi_intermediate,
+	&input_state_csi_ignore,
+	&input_state_dcs_enter,
+	&input_state_dcs_parameter,
+	&input_state_dcs_intermediate,
+	&input_state_dcs_handler,
+	&input_state_dcs_escape,
+	&input_state_dcs_ignore,
+	&input_state_osc_string,
+	&input_state_apc_string,
+	&input_state_rename_string,
+	&input_state_consume_st,
 };
 
 /* ground state table. */
@@ -785,12 +848,54 @@ input_restore_state(struct input_ctx *ictx)
 	screen_write_cursormove(sctx, ictx->old_cx, ictx->old_cy, 0);
 }
 
+/*
+ * Build the lookup table for each state from its transitions, checking every
+ * byte has one.
+ */
+static void
+input_build_lookup(void)
+{
+	const struct input_state	*state;
+	const struct input_transition	*itr;
+	u_int				 i, ch, n;
+
+	for (i = 0; i < nitems(input_states); i++) {
+		state = input_states[i];
+		memset(state->lookup, 0xff, 256);
+
+		n = 0;
+		for (itr = state->transitions; itr->first != -1; itr++) {
+			if (n == 0xff)
+				fatalx("too many transitions in state %s", state->name);
+			for (ch = itr->first; ch <= (u_int)itr->last; ch++) {
+				/* The first matching transition wins. */
+				if (state->lookup[ch] == 0xff)
+					state->lookup[ch] = n;
+			}
+			n++;
+		}
+
+		for (ch = 0; ch < 256; ch++) {
+			if (state->lookup[ch] == 0xff) {
+				fatalx("no transition from state %s for %02x",
+				    state->name, ch);
+			}
+		}
+	}
+}
+
 /* Initialise input parser. */
 void
 input_init(struct window_pane *wp)
 {
+	static int		 built;
 	struct input_ctx	*ictx;
 
+	if (!built) {
+		input_build_lookup();
+		built = 1;
+	}
+
 	ictx = wp->ictx = xcalloc(1, sizeof *ictx);
 
 	ictx->input_space = INPUT_BUF_START;
@@ -889,7 +994,7 @@ input_parse_buffer(struct window_pane *wp, u_char *buf, size_t len)
 	struct input_ctx		*ictx = wp->ictx;
 	struct screen_write_ctx		*sctx = &ictx->ctx;
 	const struct input_transition	*itr;
-	size_t				 off = 0;
+	size_t				 off = 0, n;
 
 	if (len == 0)
 		return;
@@ -913,19 +1018,28 @@ input_parse_buffer(struct window_pane *wp, u_char *buf, size_t len)
 
 	/* Parse the input. */
 	while (off < len) {
+		/* Printable text in the ground state is written as a run. */
+		if (ictx->state == &input_state_ground) {
+			n = input_printable(buf + off, len - off);
+			if (n != 0) {
+				input_print_string(ictx, buf + off, n);
+				off += n;
+				continue;
+			}
+			if (!ictx->utf8started) {
+				n = input_print_utf8(ictx, buf + off,
+				    len - off);
+				if (n != 0) {
+					off += n;
+					continue;
+				}
+			}
+		}
+
 		ictx->ch = buf[off++];
 
 		/* Find the transition. */
-		itr = ictx->state->transitions;
-		while (itr->first != -1 && itr->last != -1) {
-			if (ictx->ch >= itr->first && ictx->ch <= itr->last)
-				break;
-			itr++;
-		}
-		if (itr->first == -1 || itr->last == -1) {
-			/* No transition? Eh? */
-			fatalx("no transition from state");
-		}
+		itr = &ictx->state->transitions[ictx->state->lookup[ictx->ch]];
 
 		/*
 		 * Any state except print stops the current collection. This is
@@ -1101,6 +1215,78 @@ input_print(struct input_ctx *ictx)
 	return (0);
 }
 
+/* Count the printable ASCII characters at the start of a buffer. */
+static size_t
+input_printable(const u_char *buf, size_t len)
+{
+	const uint64_t	 ones = 0x0101010101010101ULL;
+	const uint64_t	 highs = ones * 0x80;
+	uint64_t	 v;
+	size_t		 n = 0;
+
+	/*
+	 * Eight at a time: a top bit is set in v - 0x20 for any byte below
+	 * 0x20, in v for any above 0x7f, and in v + 1 for 0x7f, and in none of
+	 * them if every byte is printable.
+	 */
+	while (len - n >= sizeof v) {
+		memcpy(&v, buf + n, sizeof v);
+		if (((v - ones * 0x20) | v | (v + ones)) & highs)
+			break;
+		n += sizeof v;
+	}
+	while (n < len && buf[n] >= 0x20 && buf[n] <= 0x7e)
+		n++;
+	return (n);
+}
+
+/* Output a run of printable characters to the screen. */
+static void
+input_print_string(struct input_ctx *ictx, const u_char *buf, size_t len)
+{
+	struct screen_write_ctx	*sctx = &ictx->ctx;
+	int			 set;
+
+	ictx->utf8started = 0; /* can't be valid UTF-8 */
+
+	set = ictx->cell.set == 0 ? ictx->cell.g0set : ictx->cell.g1set;
+	if (set == 1)
+		ictx->cell.cell.attr |= GRID_ATTR_CHARSET;
+	else
+		ictx->cell.cell.attr &= ~GRID_ATTR_CHARSET;
+
+	ictx->ch = buf[len - 1];
+	utf8_set(&ictx->cell.cell.data, ictx->ch);
+	screen_write_collect_string(sctx, &ictx->cell.cell, buf, len);
+	ictx->last = ictx->ch;
+
+	ictx->cell.cell.attr &= ~GRID_ATTR_CHARSET;
+}
+
+/*
+ * Output a run of complete UTF-8 characters to the screen, returning the
+ * number of bytes used. Anything else, including a character split across
+ * buffers, is left to input_top_bit_set.
+ */
+static size_t
+input_print_utf8(struct input_ctx *ictx, const u_char *buf, size_t len)
+{
+	struct screen_write_ctx	*sctx = &ictx->ctx;
+	struct utf8_data	 ud;
+	size_t			 off = 0, n;
+
+	while (off < len && buf[off] >= 0x80) {
+		if ((n = utf8_decode(&ud, buf + off, len - off)) == 0)
+			break;
+		utf8_copy(&ictx->cell.cell.data, &ud);
+		screen_write_collect_add(sctx, &ictx->cell.cell);
+		off += n;
+	}
+	if (off != 0)
+		ictx->last = -1;
+	return (off);
+}
+
 /* Collect intermediate string. */
 static int
 input_intermediate(struct input_ctx *ictx)
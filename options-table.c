@@ -65,6 +65,11 @@ static const char *options_table_set_clipboard_list[] = {
 static const char *options_table_window_size_list[] = {
 	"largest", "smallest", "manual", NULL
 };
+#ifdef XTMUX
+static const char *options_table_xtmux_renderer_list[] = {
+	"core", "xrender", "shm", NULL
+};
+#endif
 
 /* Status line format. */
 #define OPTIONS_TABLE_STATUS_FORMAT1 \
@@ -813,6 +818,18 @@ const struct options_table_entry options_table[] = {
 	  .default_str = ""
 	},
 
+	{ .name = "xtmux-double-buffer",
+	  .type = OPTIONS_TABLE_FLAG,
+	  .scope = OPTIONS_TABLE_CLIENT,
+	  .default_num = 0
+	},
+
+	{ .name = "xtmux-fallback-fonts",
+	  .type = OPTIONS_TABLE_STRING,
+	  .scope = OPTIONS_TABLE_CLIENT,
+	  .default_str = ""
+	},
+
 	{ .name = "xtmux-fg",
 	  .type = OPTIONS_TABLE_STRING,
 	  .scope = OPTIONS_TABLE_CLIENT,
@@ -831,6 +848,14 @@ const struct options_table_entry options_table[] = {
 	  .default_str = ""
 	},
 
+	{ .name = "xtmux-max-fps",
+	  .type = OPTIONS_TABLE_NUMBER,
+	  .scope = OPTIONS_TABLE_CLIENT,
+	  .minimum = 0,
+	  .maximum = 1000,
+	  .default_num = 30
+	},
+
 	{ .name = "xtmux-name",
 	  .type = OPTIONS_TABLE_STRING,
 	  .scope = OPTIONS_TABLE_CLIENT,
@@ -854,6 +879,13 @@ const struct options_table_entry options_table[] = {
 	  .scope = OPTIONS_TABLE_CLIENT,
 	  .default_str = ""
 	},
+
+	{ .name = "xtmux-renderer",
+	  .type = OPTIONS_TABLE_CHOICE,
+	  .scope = OPTIONS_TABLE_CLIENT,
+	  .choices = options_table_xtmux_renderer_list,
+	  .default_num = 1
+	},
 #endif
 
 	/* Hook options. */
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+# pane input with UTF-8: whole and split characters, wide characters at the
+# end of a line, and sequences that are not valid
+
+PATH=/bin:/usr/bin
+TERM=screen
+
+[ -z "$TEST_TMUX" ] && TEST_TMUX=$(readlink -f ../tmux)
+TMUX="$TEST_TMUX -f/dev/null -Ltest"
+$TMUX kill-server 2>/dev/null
+
+TMP=$(mktemp)
+trap "rm -f $TMP" 0 1 15
+
+# each printf is a separate write, so the characters at the ends of the
+# second and third lines are split across reads
+$TMUX new -d -x20 -y10 "
+	printf 'ab\303\251\344\270\255\360\237\230\200cd\n';
+	printf 'x\344'; sleep 0.2; printf '\270\255y\360\237'; sleep 0.2;
+	printf '\230\200z\n';
+	printf 'abcdefghijklmnopqrs\344\270\255\357\274\241\n';
+	printf '[\300\257][\340\200\257][\355\240\200][\200][\344\270]\n';
+	printf '[\364\220\200\200][\370\210\200\200\200]end\n';
+	printf 'e\314\201 \343\201\202\314\200 \033[1m\316\261\316\262\033[m\316\263\n';
+	cat" || exit 1
+sleep 1
+
+$TMUX capturep -p|awk '{print NR-1,$0}' >$TMP
+$TMUX kill-server 2>/dev/null
+
+cmp -s $TMP utf8-input.result || exit 1
+exit 0
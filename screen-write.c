@@ -43,7 +43,8 @@ struct screen_write_collect_item {
 	u_int			 x;
 	int			 wrapped;
 
-	u_int			 used;
+	u_int			 used;	/* bytes of UTF-8 in data */
+	u_int			 width;	/* cells covered */
 	char			 data[256];
 
 	struct grid_cell	 gc;
@@ -54,6 +55,46 @@ struct screen_write_collect_line {
 	TAILQ_HEAD(, screen_write_collect_item) items;
 };
 
+/*
+ * Finished collect items and the last line list are kept for the next writer
+ * rather than freed, so busy panes do not allocate at all once they have as
+ * many as they need. Both are capped so a burst does not pin its memory for
+ * good: items at a few screens of short runs, and the list at a tall screen.
+ */
+#define SCREEN_WRITE_FREE_ITEMS 1024
+#define SCREEN_WRITE_FREE_LINES 1000
+
+static TAILQ_HEAD(, screen_write_collect_item) screen_write_free_items =
+    TAILQ_HEAD_INITIALIZER(screen_write_free_items);
+static u_int screen_write_free_items_count;
+static struct screen_write_collect_line *screen_write_free_list;
+static u_int screen_write_free_list_size;
+
+static struct screen_write_collect_item *
+screen_write_get_item(void)
+{
+	struct screen_write_collect_item	*ci;
+
+	ci = TAILQ_FIRST(&screen_write_free_items);
+	if (ci == NULL)
+		return (xcalloc(1, sizeof *ci));
+	TAILQ_REMOVE(&screen_write_free_items, ci, entry);
+	screen_write_free_items_count--;
+	memset(ci, 0, sizeof *ci);
+	return (ci);
+}
+
+static void
+screen_write_free_item(struct screen_write_collect_item *ci)
+{
+	if (screen_write_free_items_count >= SCREEN_WRITE_FREE_ITEMS) {
+		free(ci);
+		return;
+	}
+	TAILQ_INSERT_HEAD(&screen_write_free_items, ci, entry);
+	screen_write_free_items_count++;
+}
+
 static void
 screen_write_offset_timer(__unused int fd, __unused short events, void *data)
 {
@@ -111,10 +152,19 @@ screen_write_start(struct screen_write_ctx *ctx, struct window_pane *wp,
 	else
 		ctx->s = s;
 
-	ctx->list = xcalloc(screen_size_y(ctx->s), sizeof *ctx->list);
+	/* Nested writers allocate their own list. */
+	if (screen_write_free_list != NULL &&
+	    screen_write_free_list_size >= screen_size_y(ctx->s)) {
+		ctx->list = screen_write_free_list;
+		ctx->list_size = screen_write_free_list_size;
+		screen_write_free_list = NULL;
+	} else {
+		ctx->list_size = screen_size_y(ctx->s);
+		ctx->list = xcalloc(ctx->list_size, sizeof *ctx->list);
+	}
 	for (y = 0; y < screen_size_y(ctx->s); y++)
 		TAILQ_INIT(&ctx->list[y].items);
-	ctx->item = xcalloc(1, sizeof *ctx->item);
+	ctx->item = screen_write_get_item();
 
 	ctx->scrolled = 0;
 	ctx->bg = 8;
@@ -137,8 +187,18 @@ screen_write_stop(struct screen_write_ctx *ctx)
 	log_debug("%s: %u cells (%u written, %u skipped)", __func__,
 	    ctx->cells, ctx->written, ctx->skipped);
 
-	free(ctx->item);
-	free(ctx->list); /* flush will have emptied */
+	screen_write_free_item(ctx->item);
+
+	/* Flush will have emptied the list. Keep the biggest up to the cap. */
+	if (ctx->list_size > SCREEN_WRITE_FREE_LINES)
+		free(ctx->list);
+	else if (screen_write_free_list == NULL ||
+	    ctx->list_size > screen_write_free_list_size) {
+		free(screen_write_free_list);
+		screen_write_free_list = ctx->list;
+		screen_write_free_list_size = ctx->list_size;
+	} else
+		free(ctx->list);
 }
 
 /* Reset screen state. */
@@ -1210,12 +1270,12 @@ screen_write_collect_clear(struct screen_write_ctx *ctx, u_int y, u_int n)
 			continue;
 		size = 0;
 		TAILQ_FOREACH_SAFE(ci, &ctx->list[i].items, entry, tmp) {
-			size += ci->used;
+			size += ci->width;
 			TAILQ_REMOVE(&ctx->list[i].items, ci, entry);
-			free(ci);
+			screen_write_free_item(ci);
 		}
 		ctx->skipped += size;
-		log_debug("%s: dropped %zu bytes (line %u)", __func__, size, i);
+		log_debug("%s: dropped %zu cells (line %u)", __func__, size, i);
 	}
 }
 
@@ -1273,19 +1333,19 @@ screen_write_collect_flush(struct screen_write_ctx *ctx, int scroll_only)
 			ttyctx.cell = &ci->gc;
 			ttyctx.wrapped = ci->wrapped;
 			ttyctx.ptr = ci->data;
-			ttyctx.num = ci->used;
+			ttyctx.num = ci->width;
 			tty_write(tty_cmd_cells, &ttyctx);
 
 			items++;
-			written += ci->used;
+			written += ci->width;
 
 			TAILQ_REMOVE(&ctx->list[y].items, ci, entry);
-			free(ci);
+			screen_write_free_item(ci);
 		}
 	}
 	s->cx = cx; s->cy = cy;
 
-	log_debug("%s: flushed %u items (%zu bytes)", __func__, items, written);
+	log_debug("%s: flushed %u items (%zu cells)", __func__, items, written);
 	ctx->written += written;
 }
 
@@ -1296,7 +1356,7 @@ screen_write_collect_end(struct screen_write_ctx *ctx)
 	struct screen				*s = ctx->s;
 	struct screen_write_collect_item	*ci = ctx->item;
 	struct grid_cell			 gc;
-	u_int					 xx;
+	u_int					 xx, i, n, w;
 
 	if (ci->used == 0)
 		return;
@@ -1304,7 +1364,7 @@ screen_write_collect_end(struct screen_write_ctx *ctx)
 
 	ci->x = s->cx;
 	TAILQ_INSERT_TAIL(&ctx->list[s->cy].items, ci, entry);
-	ctx->item = xcalloc(1, sizeof *ctx->item);
+	ctx->item = screen_write_get_item();
 
 	log_debug("%s: %u %s (at %u,%u)", __func__, ci->used, ci->data, s->cx,
 	    s->cy);
@@ -1324,8 +1384,25 @@ screen_write_collect_end(struct screen_write_ctx *ctx)
 	}
 
 	memcpy(&gc, &ci->gc, sizeof gc);
-	grid_view_set_cells(s->grid, s->cx, s->cy, &gc, ci->data, ci->used);
-	screen_write_set_cursor(ctx, s->cx + ci->used, -1);
+	if (ci->used == ci->width)
+		grid_view_set_cells(s->grid, s->cx, s->cy, &gc, ci->data, ci->used);
+	else {
+		/* Not all ASCII, so set each character and its padding. */
+		xx = s->cx;
+		for (i = 0; i < ci->used; i += n) {
+			n = utf8_decode(&gc.data, (u_char *)ci->data + i,
+			    ci->used - i);
+			if (n == 0)
+				break;
+			grid_view_set_cell(s->grid, xx, s->cy, &gc);
+			for (w = 1; w < gc.data.width; w++) {
+				grid_view_set_cell(s->grid, xx + w, s->cy,
+				    &screen_write_pad_cell);
+			}
+			xx += gc.data.width;
+		}
+	}
+	screen_write_set_cursor(ctx, s->cx + ci->width, -1);
 
 	for (xx = s->cx; xx < screen_size_x(s); xx++) {
 		grid_view_get_cell(s->grid, xx, s->cy, &gc);
@@ -1343,18 +1420,25 @@ screen_write_collect_add(struct screen_write_ctx *ctx,
 	struct screen				*s = ctx->s;
 	struct screen_write_collect_item	*ci;
 	u_int					 sx = screen_size_x(s);
+	u_int					 size = gc->data.size;
+	u_int					 width = gc->data.width;
+	struct utf8_data			 ud;
 	int					 collect;
 
 	/*
 	 * Don't need to check that the attributes and whatnot are still the
 	 * same - input_parse will end the collection when anything that isn't
 	 * a plain character is encountered. Also nothing should make it here
-	 * that isn't a single ASCII character.
+	 * that isn't a single ASCII or UTF-8 character.
 	 */
 
 	collect = 1;
-	if (gc->data.width != 1 || gc->data.size != 1 || *gc->data.data >= 0x7f)
+	if (width == 0 || width > 2 || width > sx)
+		collect = 0;
+	else if (size == 1 && *gc->data.data >= 0x7f)
 		collect = 0;
+	else if (size != 1 && utf8_decode(&ud, gc->data.data, size) != size)
+		collect = 0; /* could not be split up again */
 	else if (gc->attr & GRID_ATTR_CHARSET)
 		collect = 0;
 	else if (~s->mode & MODE_WRAP)
@@ -1371,11 +1455,12 @@ screen_write_collect_add(struct screen_write_ctx *ctx,
 	}
 	ctx->cells++;
 
-	if (s->cx > sx - 1 || ctx->item->used > sx - 1 - s->cx)
+	if (s->cx + ctx->item->width + width > sx ||
+	    ctx->item->used + size > (sizeof ctx->item->data) - 1)
 		screen_write_collect_end(ctx);
 	ci = ctx->item; /* may have changed */
 
-	if (s->cx > sx - 1) {
+	if (s->cx + width > sx) {
 		log_debug("%s: wrapped at %u,%u", __func__, s->cx, s->cy);
 		ci->wrapped = 1;
 		screen_write_linefeed(ctx, 1, 8);
@@ -1384,11 +1469,72 @@ screen_write_collect_add(struct screen_write_ctx *ctx,
 
 	if (ci->used == 0)
 		memcpy(&ci->gc, gc, sizeof ci->gc);
-	ci->data[ci->used++] = gc->data.data[0];
+	memcpy(ci->data + ci->used, gc->data.data, size);
+	ci->used += size;
+	ci->width += width;
 	if (ci->used == (sizeof ci->data) - 1)
 		screen_write_collect_end(ctx);
 }
 
+/*
+ * Write a run of printable ASCII characters with the same attributes, as if
+ * each had been given to screen_write_collect_add in turn.
+ */
+void
+screen_write_collect_string(struct screen_write_ctx *ctx,
+    const struct grid_cell *gc, const u_char *data, size_t len)
+{
+	struct screen				*s = ctx->s;
+	struct screen_write_collect_item	*ci;
+	struct grid_cell			 tmp;
+	u_int					 sx = screen_size_x(s), n;
+
+	if ((gc->attr & GRID_ATTR_CHARSET) ||
+	    (~s->mode & MODE_WRAP) ||
+	    (s->mode & MODE_INSERT) ||
+	    s->sel != NULL) {
+		memcpy(&tmp, gc, sizeof tmp);
+		for (; len != 0; len--) {
+			utf8_set(&tmp.data, *data++);
+			screen_write_collect_add(ctx, &tmp);
+		}
+		return;
+	}
+
+	while (len != 0) {
+		if (s->cx + ctx->item->width + 1 > sx ||
+		    ctx->item->used + 1 > (sizeof ctx->item->data) - 1)
+			screen_write_collect_end(ctx);
+		ci = ctx->item; /* may have changed */
+
+		if (s->cx + 1 > sx) {
+			log_debug("%s: wrapped at %u,%u", __func__, s->cx,
+			    s->cy);
+			ci->wrapped = 1;
+			screen_write_linefeed(ctx, 1, 8);
+			screen_write_set_cursor(ctx, 0, -1);
+		}
+
+		/* As much as fits on this line and in this item. */
+		n = sx - s->cx - ci->width;
+		if (n > (sizeof ci->data) - 1 - ci->used)
+			n = (sizeof ci->data) - 1 - ci->used;
+		if (n > len)
+			n = len;
+
+		if (ci->used == 0)
+			memcpy(&ci->gc, gc, sizeof ci->gc);
+		memcpy(ci->data + ci->used, data, n);
+		ci->used += n;
+		ci->width += n;
+		ctx->cells += n;
+		data += n;
+		len -= n;
+		if (ci->used == (sizeof ci->data) - 1)
+			screen_write_collect_end(ctx);
+	}
+}
+
 /* Write cell data. */
 void
 screen_write_cell(struct screen_write_ctx *ctx, const struct grid_cell *gc)
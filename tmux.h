@@ -732,6 +732,7 @@ struct screen_write_ctx {
 
 	struct screen_write_collect_item *item;
 	struct screen_write_collect_line *list;
+	u_int			 list_size;
 	u_int			 scrolled;
 	u_int			 bg;
 
@@ -2342,6 +2343,8 @@ void	 screen_write_clearhistory(struct screen_write_ctx *);
 void	 screen_write_collect_end(struct screen_write_ctx *);
 void	 screen_write_collect_add(struct screen_write_ctx *,
 	     const struct grid_cell *);
+void	 screen_write_collect_string(struct screen_write_ctx *,
+	     const struct grid_cell *, const u_char *, size_t);
 void	 screen_write_cell(struct screen_write_ctx *, const struct grid_cell *);
 void	 screen_write_setselection(struct screen_write_ctx *, u_char *, u_int);
 void	 screen_write_rawstring(struct screen_write_ctx *, u_char *, u_int);
@@ -2620,6 +2623,7 @@ void		 utf8_set(struct utf8_data *, u_char);
 void		 utf8_copy(struct utf8_data *, const struct utf8_data *);
 enum utf8_state	 utf8_open(struct utf8_data *, u_char);
 enum utf8_state	 utf8_append(struct utf8_data *, u_char);
+size_t		 utf8_decode(struct utf8_data *, const u_char *, size_t);
 enum utf8_state	 utf8_combine(const struct utf8_data *, wchar_t *);
 enum utf8_state	 utf8_split(wchar_t, struct utf8_data *);
 int		 utf8_isvalid(const char *);
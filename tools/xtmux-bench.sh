@@ -0,0 +1,169 @@
+#!/bin/sh
+#
+# Measure how xtmux draws some typical output on a private Xvfb server.
+#
+# For each workload this prints the frames xtmux drew and, per frame, the X
+# requests and bytes the tmux server sent, the CPU time the X server used and
+# the wall time taken. Requests are counted from the server log (-v), bytes
+# and CPU time from /proc, so those are only reported on Linux. The log counts
+# every request on the display between frames, including selection traffic,
+# so this uses a single window with nothing else on its display.
+#
+# usage: xtmux-bench.sh [-r core|xrender|shm] [workload ...]
+# where workload is any of: log scroll top colour (default all). TEST_TMUX
+# names the tmux binary, as for the regress tests.
+
+[ -z "$TEST_TMUX" ] && TEST_TMUX=$(readlink -f ../tmux)
+RENDERER=xrender
+WORKLOADS="log scroll top colour"
+
+while getopts r: opt; do
+	case $opt in
+	r)	RENDERER=$OPTARG;;
+	*)	echo "usage: $0 [-r renderer] [workload ...]" >&2; exit 1;;
+	esac
+done
+shift $(($OPTIND - 1))
+[ $# -gt 0 ] && WORKLOADS="$*"
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+	echo "$0: Xvfb not found, skipping" >&2
+	exit 0
+fi
+if ! "$TEST_TMUX" -V >/dev/null 2>&1; then
+	echo "$0: no tmux at $TEST_TMUX" >&2
+	exit 1
+fi
+
+TMP=$(mktemp -d)
+SOCKET=xtmux-bench-$$
+TMUX="$TEST_TMUX -L$SOCKET"
+DPY=:$((100 + $$ % 100))
+XPID=
+trap 'cd /; $TMUX kill-server 2>/dev/null; [ -n "$XPID" ] && kill $XPID 2>/dev/null; rm -rf $TMP' 0 1 15
+
+# The workloads, each writing to the pane until done.
+cat >$TMP/log.awk <<'EOF'
+BEGIN {
+	for (i = 0; i < 20000; i++)
+		printf "%06d INFO  worker[%d]: handled GET /api/v1/items/%d in %d ms\n",
+		    i, i % 8, i * 7, i % 97
+}
+EOF
+cat >$TMP/scroll.awk <<'EOF'
+BEGIN {
+	# like an editor scrolling a file down and back up in a region
+	printf "\033[2J\033[1;23r"
+	for (i = 0; i < 3000; i++)
+		printf "\033[23;1H\n\033[34m%5d\033[m  for (i = 0; i < n; i++) { sum += a[%d]; }\033[K", i, i
+	for (i = 3000; i > 0; i--)
+		printf "\033[1;1H\033M\033[34m%5d\033[m  while (p != NULL) p = p->next; /* %d */\033[K", i, i
+	printf "\033[r\033[2J\033[H"
+}
+EOF
+cat >$TMP/top.awk <<'EOF'
+BEGIN {
+	# whole screen repainted in place with a few colours, like top or htop
+	for (f = 0; f < 300; f++) {
+		printf "\033[H\033[1;37;44m  PID USER     %%CPU %%MEM COMMAND%50s\033[m\n", ""
+		for (r = 0; r < 22; r++)
+			printf "\033[32m%5d\033[m %-8s \033[%dm%4.1f\033[m %4.1f %-40s\033[K\n",
+			    1000 + r, "user" r % 3, (f + r) % 3 ? 39 : 31,
+			    ((f * 7 + r * 13) % 1000) / 10, (r * 3 % 100) / 10,
+			    "process-" r "-" f
+	}
+}
+EOF
+cat >$TMP/colour.awk <<'EOF'
+BEGIN {
+	# every cell a different colour, 256 and RGB
+	for (f = 0; f < 100; f++) {
+		printf "\033[H"
+		for (r = 0; r < 23; r++) {
+			for (c = 0; c < 80; c++) {
+				if ((r + f) % 2)
+					printf "\033[48;5;%dm%c", (r * 80 + c + f) % 256, 33 + (c + f) % 94
+				else
+					printf "\033[38;2;%d;%d;%dm%c", c * 3, r * 11, f * 2, 33 + (c + f) % 94
+			}
+			printf "\033[m\n"
+		}
+	}
+}
+EOF
+
+cat >$TMP/conf <<EOF
+set -g xtmux-renderer $RENDERER
+set -g xtmux-max-fps 0
+EOF
+
+Xvfb $DPY -screen 0 1920x1200x24 -nolisten tcp >/dev/null 2>&1 &
+XPID=$!
+sleep 1
+if ! kill -0 $XPID 2>/dev/null; then
+	echo "$0: Xvfb did not start on $DPY" >&2
+	exit 1
+fi
+
+cd $TMP
+DISPLAY=$DPY $TEST_TMUX -v -x -L$SOCKET -f$TMP/conf new -s bench 'cat' \
+	>/dev/null 2>&1 </dev/null &
+sleep 2
+PID=$($TMUX display -p '#{pid}' 2>/dev/null)
+LOG=$TMP/tmux-server-$PID.log
+if [ -z "$PID" ] || [ ! -f $LOG ]; then
+	echo "$0: xtmux did not start" >&2
+	exit 1
+fi
+TICK=$(getconf CLK_TCK)
+
+now() {
+	date +%s.%N | sed 's/N$/0/'
+}
+wchar() {
+	awk '$1 == "wchar:" { print $2 }' /proc/$PID/io 2>/dev/null || echo 0
+}
+xcpu() {
+	awk '{ print $14 + $15 }' /proc/$XPID/stat 2>/dev/null || echo 0
+}
+
+printf "%-8s %7s %10s %12s %14s %14s\n" workload frames "req/frame" \
+	"bytes/frame" "X ms/frame" "wall ms/frame"
+for w in $WORKLOADS; do
+	if [ ! -f $TMP/$w.awk ]; then
+		echo "$0: unknown workload $w" >&2
+		continue
+	fi
+	$TMUX clear-history -t bench
+	lines=$(wc -l <$LOG)
+	bytes=$(wchar)
+	cpu=$(xcpu)
+	start=$(now)
+
+	$TMUX respawn-pane -k -t bench \
+		"awk -f $TMP/$w.awk; $TMUX wait -S $SOCKET; exec cat"
+	$TMUX wait $SOCKET
+	# let the last frames be drawn
+	sleep 1
+
+	end=$(now)
+	bytes=$(($(wchar) - bytes))
+	cpu=$(($(xcpu) - cpu))
+	tail -n +$(($lines + 1)) $LOG | awk -v w=$w -v bytes=$bytes -v cpu=$cpu \
+	    -v tick=$TICK -v wall="$end - $start" '
+		/: frame of [0-9]+ requests/ {
+			for (i = 1; i <= NF; i++)
+				if ($i == "of")
+					req += $(i + 1)
+			frames++
+		}
+		END {
+			split(wall, t, " - ")
+			ms = (t[1] - t[2]) * 1000 - 1000
+			n = frames ? frames : 1
+			printf "%-8s %7d %10.1f %12.0f %14.3f %14.3f\n", w, frames,
+			    req / n, bytes / n, cpu * 1000 / tick / n, ms / n
+		}'
+done
+
+exit 0
@@ -1957,6 +1957,8 @@ void
 tty_cmd_cells(struct tty *tty, const struct tty_ctx *ctx)
 {
 	struct window_pane	*wp = ctx->wp;
+	struct grid_cell	 gc;
+	size_t			 len, i, n;
 
 	if (!tty_is_visible(tty, ctx, ctx->ocx, ctx->ocy, ctx->num, 1))
 		return;
@@ -1981,7 +1983,20 @@ tty_cmd_cells(struct tty *tty, const struct tty_ctx *ctx)
 	tty_cursor_pane_unless_wrap(tty, ctx, ctx->ocx, ctx->ocy);
 
 	tty_attributes(tty, ctx->cell, ctx->wp);
-	tty_putn(tty, ctx->ptr, ctx->num, ctx->num);
+	len = strlen(ctx->ptr);
+	if (len == ctx->num) {
+		tty_putn(tty, ctx->ptr, len, ctx->num);
+		return;
+	}
+
+	/* Not all ASCII, so each character is checked against the terminal. */
+	memcpy(&gc, ctx->cell, sizeof gc);
+	for (i = 0; i < len; i += n) {
+		n = utf8_decode(&gc.data, (u_char *)ctx->ptr + i, len - i);
+		if (n == 0)
+			break;
+		tty_cell(tty, &gc, wp);
+	}
 }
 
 void
@@ -27,6 +27,14 @@
 #include "tmux.h"
 
 static int	utf8_width(wchar_t);
+static int	utf8_width_lookup(wchar_t);
+
+/*
+ * Widths of characters in the Basic Multilingual Plane already found by
+ * utf8_width, two bits each: zero if not looked up yet, otherwise the width
+ * plus one.
+ */
+static u_char	utf8_width_cache[0x10000 / 4];
 
 /* Set a single character. */
 void
@@ -104,9 +112,81 @@ utf8_append(struct utf8_data *ud, u_char ch)
 	return (UTF8_DONE);
 }
 
+/*
+ * Decode one character from the start of a buffer: an ASCII byte as utf8_set,
+ * or UTF-8 as utf8_open and utf8_append would for each of its bytes in turn.
+ * Returns the number of bytes used, or zero if the buffer does not start with
+ * a complete, valid character that can be displayed, which is left to the
+ * byte-at-a-time path.
+ */
+size_t
+utf8_decode(struct utf8_data *ud, const u_char *buf, size_t len)
+{
+	wchar_t	wc;
+	u_int	size, i;
+	int	width;
+
+	if (buf[0] < 0x80) {
+		utf8_set(ud, buf[0]);
+		return (1);
+	}
+	if (buf[0] >= 0xc2 && buf[0] <= 0xdf) {
+		size = 2;
+		wc = buf[0] & 0x1f;
+	} else if (buf[0] >= 0xe0 && buf[0] <= 0xef) {
+		size = 3;
+		wc = buf[0] & 0x0f;
+	} else if (buf[0] >= 0xf0 && buf[0] <= 0xf4) {
+		size = 4;
+		wc = buf[0] & 0x07;
+	} else
+		return (0);
+	if (len < size)
+		return (0);
+
+	/* Reject overlong forms, surrogates and anything above U+10FFFF. */
+	if ((buf[0] == 0xe0 && buf[1] < 0xa0) ||
+	    (buf[0] == 0xed && buf[1] >= 0xa0) ||
+	    (buf[0] == 0xf0 && buf[1] < 0x90) ||
+	    (buf[0] == 0xf4 && buf[1] >= 0x90))
+		return (0);
+	for (i = 1; i < size; i++) {
+		if ((buf[i] & 0xc0) != 0x80)
+			return (0);
+		wc = (wc << 6) | (buf[i] & 0x3f);
+	}
+
+	if ((width = utf8_width(wc)) < 0)
+		return (0);
+
+	memset(ud, 0, sizeof *ud);
+	memcpy(ud->data, buf, size);
+	ud->have = ud->size = size;
+	ud->width = width;
+	return (size);
+}
+
 /* Get width of Unicode character. */
 static int
 utf8_width(wchar_t wc)
+{
+	int	width;
+	u_int	cached;
+
+	if (wc >= 0 && wc < 0x10000) {
+		cached = utf8_width_cache[wc / 4] >> (wc % 4 * 2) & 3;
+		if (cached != 0)
+			return (cached - 1);
+	}
+	width = utf8_width_lookup(wc);
+	if (wc >= 0 && wc < 0x10000 && width >= 0 && width <= 2)
+		utf8_width_cache[wc / 4] |= (width + 1) << (wc % 4 * 2);
+	return (width);
+}
+
+/* Look up width of Unicode character. */
+static int
+utf8_width_lookup(wchar_t wc)
 {
 	int	width;
 
@@ -3496,7 +3496,8 @@ window_copy_drag_update(struct client *c, struct mouse_event *m)
 	struct window_pane		*wp;
 	struct window_mode_entry	*wme;
 	struct window_copy_mode_data	*data;
-	u_int				 x, y, old_cx, old_cy;
+	u_int				 x, y, old_cx, old_cy, old_oy;
+	int				 redraw;
 	struct timeval			 tv = {
 		.tv_usec = WINDOW_COPY_DRAG_REPEAT_TIME
 	};
@@ -3520,10 +3521,18 @@ window_copy_drag_update(struct client *c, struct mouse_event *m)
 		return;
 	old_cx = data->cx;
 	old_cy = data->cy;
+	old_oy = data->oy;
 
+	/*
+	 * Only the lines between the old and new cursor change, unless this
+	 * is a rectangle whose width changed, and nothing if it did not move.
+	 */
 	window_copy_update_cursor(wme, x, y);
-	if (window_copy_update_selection(wme, 1))
-		window_copy_redraw_selection(wme, old_cy);
+	if (old_cx != data->cx || old_cy != data->cy || old_oy != data->oy) {
+		redraw = (old_cx != data->cx || old_oy != data->oy);
+		if (window_copy_update_selection(wme, redraw))
+			window_copy_redraw_selection(wme, old_cy);
+	}
 	if (old_cy != data->cy || old_cx == data->cx) {
 		if (y == 0) {
 			evtimer_add(&data->dragtimer, &tv);
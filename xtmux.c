@@ -22,6 +22,14 @@
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
 #include <X11/cursorfont.h>
+#ifdef HAVE_XRENDER
+#include <X11/extensions/Xrender.h>
+#endif
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 #ifdef DEBUG
 #include <assert.h>
 #endif
@@ -34,13 +42,24 @@
 		Y = _x; \
 	})
 
+static void xtmux_flush(struct tty *);
+static void xtmux_event(struct tty *, XEvent *);
 static void xtmux_main(struct tty *);
-static int xt_putc_flush(struct xtmux *);
-static void xtmux_redraw(struct client *, int, int, int, int);
+static void xt_expose_cells(struct xtmux *, const XRectangle *);
 static void xt_expose(struct xtmux *, XExposeEvent *);
+static void xt_dirty(struct xtmux *, u_int, u_int, u_int, u_int);
+static void xt_cells_resize(struct xtmux *, u_int, u_int);
+static void xt_flush_timer(struct xtmux *);
 static void xtmux_flush_callback(int, short, void *);
+static void xtmux_style_callback(int, short, void *);
+static void xtmux_blink_callback(int, short, void *);
+static struct font *xt_style_font(struct xtmux *, u_int);
 
 #define XTMUX_NUM_COLORS 256
+#define XTMUX_RGB_CACHE 64 /* colours allocated for RGB cells on other visuals */
+#define XTMUX_STYLE_DELAY 250 /* ms after setup to load bold and italic fonts if not drawn yet */
+#define XTMUX_BLINK_TIME 500 /* ms the cursor is shown or hidden while blinking */
+#define XTMUX_INCR_TIMEOUT 30 /* s to wait for a requestor to take the next piece of a selection */
 
 /* this is redundant with tty_acs_table ... */
 static const unsigned short xtmux_acs[128] = {
@@ -78,16 +97,68 @@ static const unsigned short xtmux_acs[128] = {
 	['~'] = 0x00B7, /* BULLET */
 };
 
-typedef u_short wchar;
+/* box drawing characters are drawn as lines rather than glyphs, so pane
+ * borders join up and can be filled in a few requests */
+#define LINE_UP		0x1
+#define LINE_DOWN	0x2
+#define LINE_LEFT	0x4
+#define LINE_RIGHT	0x8
+static const u_char xtmux_acs_lines[128] = {
+	['j'] = LINE_UP | LINE_LEFT,
+	['k'] = LINE_DOWN | LINE_LEFT,
+	['l'] = LINE_DOWN | LINE_RIGHT,
+	['m'] = LINE_UP | LINE_RIGHT,
+	['n'] = LINE_UP | LINE_DOWN | LINE_LEFT | LINE_RIGHT,
+	['q'] = LINE_LEFT | LINE_RIGHT,
+	['t'] = LINE_UP | LINE_DOWN | LINE_RIGHT,
+	['u'] = LINE_UP | LINE_DOWN | LINE_LEFT,
+	['v'] = LINE_UP | LINE_LEFT | LINE_RIGHT,
+	['w'] = LINE_DOWN | LINE_LEFT | LINE_RIGHT,
+	['x'] = LINE_UP | LINE_DOWN,
+};
 
-struct font {
-	Font fid;
+typedef u_int wchar;
+
+#define WCHAR_PADDING	0 /* right half of a wide character */
+#define WCHAR_REPLACEMENT 0xFFFD
+
+/* what a font name was found to be on a display, kept for the life of the
+ * server so that opening it again there does not have to query every
+ * character; the same name may be another font on another display */
+struct font_info {
+	LIST_ENTRY(font_info) entry;
+	char *display; /* name of the display it was loaded on */
+	char *request;
 	char *name;
 	u_short ascent, descent;
+	u_short width;
 	wchar char_max;
 	u_long *char_mask;
 };
 
+static LIST_HEAD(, font_info) font_infos = LIST_HEAD_INITIALIZER(font_infos);
+
+/* a loaded font, shared by the windows on a display that use it */
+struct font {
+	LIST_ENTRY(font) entry;
+	char *request; /* name it was loaded by */
+	u_int references;
+	Font fid;
+	const char *name; /* the rest are copied from font_info */
+	u_short ascent, descent;
+	u_short width; /* in pixels */
+	wchar char_max;
+	const u_long *char_mask;
+#ifdef HAVE_XRENDER
+	GlyphSet glyphs;
+	u_long *glyph_mask; /* which characters have been added to glyphs */
+#endif
+#ifdef HAVE_XSHM
+	u_char *atlas[256]; /* rasterized characters by block of 256, a byte per pixel */
+	u_long *atlas_mask; /* which characters are in atlas */
+#endif
+};
+
 #define FONT_CHAR_OFF(N)	((N)/(8*sizeof(u_long)))
 #define FONT_CHAR_BIT(N)	((u_long)1 << ((N)%(8*sizeof(u_long))))
 
@@ -100,29 +171,152 @@ enum font_type {
 	FONT_TYPE_COUNT
 };
 
+/* the styles above, then fallback fonts; a font index fits in 4 bits */
+#define FONT_MAX	15
+#define FONT_NONE	0xf
+/* indices of the fonts for a character in narrow and wide cells */
+#define FONT_NARROW(F)	((F) & 0xf)
+#define FONT_WIDE(F)	((F) >> 4)
+
+/* what to draw for a character below 0x80, in or out of line drawing mode */
+struct glyph_map {
+	u_short		c;
+	u_char		font;
+};
+
+enum xtmux_renderer {
+	XTMUX_RENDERER_CORE,
+	XTMUX_RENDERER_XRENDER,
+	XTMUX_RENDERER_SHM,
+};
+
 struct paste_ctx {
 	Time time;
 	struct window_pane *wp;
 	char *sep;
+	Atom target; /* UTF8_STRING, or STRING if that was refused */
+	int incr; /* the selection is arriving in pieces */
+};
+
+/* a selection being sent to another client in pieces */
+struct incr {
+	LIST_ENTRY(incr) entry;
+	struct xdisplay	*xd;
+	struct event	timer; /* given up if the requestor stops taking pieces */
+	Window		requestor;
+	int		own; /* the requestor is one of our windows, which keeps its events */
+	Atom		property, type;
+	char		*data;
+	size_t		size, sent;
+};
+
+#if defined(HAVE_XRENDER) || defined(HAVE_XSHM)
+#define GLYPH_BATCH 64 /* glyphs rasterized per round-trip */
+#endif
+
+#ifdef HAVE_XRENDER
+#define XTMUX_NUM_PENS 16
+
+struct pen {
+	unsigned long	pixel;
+	Picture		fill;
+};
+#endif
+
+/* what should be on screen at one position */
+struct cell {
+	wchar		c;
+	u_char		flags;
+	u_short		attr;
+	int		fg, bg;
 };
 
-#define PUTC_BUF_LEN 255
+/* a window XCopyArea the server may not have reported on yet */
+#define XTMUX_COPY_QUEUE 16
+/* rectangles of one expose series kept before falling back to their bounds */
+#define XTMUX_EXPOSE_RECTS 32
 
-struct putc {
-	u_int	x, y;
-	u_char  n;
-	wchar	s[PUTC_BUF_LEN];
-	struct grid_cell cell;
+struct copy {
+	u_long		serial; /* request number of the XCopyArea */
+	XRectangle	src;
+	short		dx, dy;
 };
 
-struct xtmux {
-	char		*display_name;
+/* scrolls of one region whose copy has not been done yet */
+struct scroll {
+	u_int		x, y, w, h;
+	int		n; /* lines down, or up if negative */
+};
+
+/* columns of a row which need to be drawn: [x1, x2) */
+struct span {
+	u_int		x1, x2;
+};
+
+/* the colors for one value of xtmux-colors */
+struct palette {
+	LIST_ENTRY(palette) entry;
+	char		*spec;
+	u_int		references;
+	unsigned long	colors[XTMUX_NUM_COLORS];
+};
+
+/* a colour allocated for an RGB cell */
+struct rgb_pixel {
+	u_int		rgb;
+	unsigned long	pixel;
+	int		used; /* 0 if free */
+};
+
+/* a connection to an X display, shared by all the clients on it */
+struct xdisplay {
+	LIST_ENTRY(xdisplay) entry;
+	char		*name;
+	u_int		references;
 	Display		*display;
 	struct event	event;
+	short		ioerror;
+	u_long		frame_request; /* first request after the last frame on any window */
+
+	Visual		*visual;
+	int		depth;
+	unsigned long	*rgb; /* pixel values of each red, green and blue level, if TrueColor */
+	struct rgb_pixel rgb_cache[XTMUX_RGB_CACHE]; /* otherwise */
+
+	/* windows set any state they depend on before each use */
+	GC		gc;
+	GC		cursor_gc;
+	GC		buffer_gc;
+#if defined(HAVE_XRENDER) || defined(HAVE_XSHM)
+	Pixmap		glyph_pixmap; /* scratch space for rasterizing glyphs */
+	u_int		glyph_w, glyph_h;
+	GC		glyph_gc;
+#endif
+
+	LIST_HEAD(, font) fonts;
+	LIST_HEAD(, palette) palettes;
+
+	Atom		atom_incr, atom_utf8_string, atom_targets, atom_text;
+	size_t		selection_chunk; /* largest property sent or read at once */
+	LIST_HEAD(, incr) incrs;
+};
+static LIST_HEAD(, xdisplay) xdisplays = LIST_HEAD_INITIALIZER(xdisplays);
+
+struct xtmux {
+	char		*display_name;
+	struct xdisplay	*xd;
+	Display		*display; /* xd->display */
 	Window		window;
+	Visual		*visual;
+	int		depth;
+	Drawable	draw; /* where to draw: window, or buffer if double buffering */
 	Time		last_time;
 
-	struct font	font[FONT_TYPE_COUNT];
+	struct font	*font[FONT_MAX]; /* NULL if not loaded */
+	u_char		style_pending; /* styles whose fonts are not loaded yet, by bit */
+	struct event	style_timer; /* to load them while idle */
+	u_char		*font_map[FONT_TYPE_COUNT][256]; /* fonts for BMP characters, by style */
+	struct glyph_map *low_map[FONT_TYPE_COUNT][2]; /* by style and charset */
 	u_short		cw, ch;
 
 	KeySym		prefix_key;
@@ -134,20 +328,57 @@ struct xtmux {
 
 	GC		gc;
 	unsigned long	fg, bg;
-	unsigned long	colors[XTMUX_NUM_COLORS];
+	struct palette	*palette;
+	unsigned long	*colors; /* palette->colors */
 
 	GC		cursor_gc;
+	unsigned long	cursor_pixel;
 	Pixmap		cursor;
 
+	Pixmap		buffer; /* back buffer, or None */
+	u_int		buffer_w, buffer_h;
+	GC		buffer_gc;
+	Region		damage; /* area of buffer to copy to window on flush */
+
+#ifdef HAVE_XRENDER
+	Picture		picture; /* window render target; None to use core drawing */
+	XRenderPictFormat *glyph_format;
+	struct pen	pens[XTMUX_NUM_PENS];
+#endif
+#ifdef HAVE_XSHM
+	XImage		*image; /* drawn into instead of the server, or NULL */
+	XShmSegmentInfo	shm;
+	XImage		*cursor_image; /* cursor, read back for drawing into image */
+#endif
+
 	unsigned	focus_out : 1;
+	unsigned	unmapped : 1;
+	unsigned	obscured : 1; /* fully covered by other windows */
 	unsigned	flush : 1;
+	unsigned	expose : 1; /* exposed cells should be drawn right away */
 	unsigned	cd : 1; /* 1 if cursor is drawn */
+	unsigned	blink_off : 1; /* cursor is in the hidden half of a blink */
+	unsigned	motion_pending : 1; /* motion has not been handled yet */
+	unsigned	drawn : 1; /* drawn during this pass over the display's events */
 	u_int		cx, cy; /* last drawn cursor location */
 
-	struct putc	putc_buf;
+	u_int		sx, sy;
+	struct cell	*cells; /* sx*sy */
+	struct span	*dirty; /* sy */
+	XRectangle	*fills; /* box drawing and blank cells not filled yet */
+	unsigned long	*fill_pixels;
+	u_int		nfills, fills_size;
 	struct event	flush_timer;
+	struct event	blink_timer;
+	struct timeval	frame; /* least time between draws */
+	struct timeval	last_frame;
 
-	u_short		copy_active; /* outstanding XCopyArea; should be <= 1 */
+	struct copy	copies[XTMUX_COPY_QUEUE]; /* oldest first */
+	u_int		copy_first, copy_count;
+	struct scroll	scroll;
+	XRectangle	exposed[XTMUX_EXPOSE_RECTS]; /* of the series being received */
+	u_int		nexposed;
+	XMotionEvent	motion; /* latest of this event loop pass */
 
 	struct paste_ctx paste; /* one outstanding paste request at a time is enough */
 
@@ -160,7 +391,9 @@ struct xtmux {
 #define XSCREEN		DefaultScreen(x->display)
 #define XCOLORMAP	DefaultColormap(x->display, XSCREEN)
 
-#define XUPDATE()	event_active(&x->event, EV_WRITE, 1)
+#define SERIAL_AFTER(A, B)	((long)((A) - (B)) > 0)
+
+#define XUPDATE()	event_active(&x->xd->event, EV_WRITE, 1)
 
 static u_int xdisplay_entry_count;
 static jmp_buf xdisplay_recover;
@@ -168,6 +401,7 @@ static jmp_buf xdisplay_recover;
 /* One of these must be called at every entry point before an X call: */
 #define XENTRY_CATCH 	if (tty->xtmux->ioerror || (!xdisplay_entry_count++ && setjmp(xdisplay_recover)))
 #define XENTRY(E)	XENTRY_CATCH return E
+#define XDENTRY(E)	if (xd->ioerror || (!xdisplay_entry_count++ && setjmp(xdisplay_recover))) return E
 #define XRETURN(R)	({ --xdisplay_entry_count; return R; })
 #ifdef DEBUG
 #define XRETURN_(R)	({ if (--xdisplay_entry_count) fatalx("xdisplay entry count mismatch"); return R; })
@@ -255,9 +489,14 @@ xdisplay_ioerror(Display *disp)
 {
 	u_int i;
 	struct client *c;
+	struct xdisplay *xd;
 
 	fprintf(stderr, "X11 IO error\n");
 
+	LIST_FOREACH(xd, &xdisplays, entry)
+		if (xd->display == disp)
+			xd->ioerror = 1;
+
 	TAILQ_FOREACH(c, &clients, entry) {
 		if (!c || !c->tty.xtmux || c->tty.xtmux->display != disp)
 			continue;
@@ -274,16 +513,134 @@ xdisplay_ioerror(Display *disp)
 	fatalx("X11 fatal error");
 }
 
+/* the client with a window on this display, if it is still open */
+static struct client *
+xdisplay_client(struct xdisplay *xd, Window w)
+{
+	struct client *c;
+
+	TAILQ_FOREACH(c, &clients, entry) {
+		struct xtmux *x = c->tty.xtmux;
+
+		if (x && x->xd == xd && x->window == w && c->tty.flags & TTY_OPENED)
+			return c;
+	}
+	return NULL;
+}
+
+static void
+xdisplay_incr_free(struct xdisplay *xd, struct incr *in)
+{
+	if (!in->own && !xd->ioerror)
+		XSelectInput(xd->display, in->requestor, NoEventMask);
+	evtimer_del(&in->timer);
+	LIST_REMOVE(in, entry);
+	free(in->data);
+	free(in);
+}
+
+static void
+xdisplay_incr_callback(__unused int fd, __unused short events, void *data)
+{
+	struct incr *in = data;
+	struct xdisplay *xd = in->xd;
+
+	XDENTRY();
+	xdisplay_incr_free(xd, in);
+	XFlush(xd->display);
+	XRETURN_();
+}
+
+/* wait for the requestor to take the piece just sent */
+static void
+xdisplay_incr_wait(struct incr *in)
+{
+	struct timeval tv;
+
+	tv.tv_sec = XTMUX_INCR_TIMEOUT;
+	tv.tv_usec = 0;
+	evtimer_add(&in->timer, &tv);
+}
+
+/* send the next piece of a selection once the requestor has taken the last */
+static void
+xdisplay_incr_event(struct xdisplay *xd, XEvent *xev)
+{
+	struct incr *in;
+	size_t n;
+
+	LIST_FOREACH(in, &xd->incrs, entry)
+		if (in->requestor == xev->xany.window &&
+				(xev->type != PropertyNotify || in->property == xev->xproperty.atom))
+			break;
+	if (!in)
+		return;
+
+	if (xev->type == DestroyNotify)
+	{
+		xdisplay_incr_free(xd, in);
+		return;
+	}
+	if (xev->type != PropertyNotify || xev->xproperty.state != PropertyDelete)
+		return;
+
+	n = in->size - in->sent;
+	if (n > xd->selection_chunk)
+		n = xd->selection_chunk;
+	XChangeProperty(xd->display, in->requestor, in->property, in->type, 8,
+			PropModeReplace, (unsigned char *)in->data + in->sent, n);
+	in->sent += n;
+	/* the empty piece at the end says it is done */
+	if (!n)
+		xdisplay_incr_free(xd, in);
+	else
+		xdisplay_incr_wait(in);
+}
+
+/* process events for all the windows on a display */
+static void
+xdisplay_main(struct xdisplay *xd)
+{
+	struct client *c;
+	XEvent xev;
+
+	TAILQ_FOREACH(c, &clients, entry)
+		if (c->tty.xtmux && c->tty.xtmux->xd == xd && c->tty.flags & TTY_OPENED)
+			xtmux_flush(&c->tty);
+
+	while (XPending(xd->display))
+	{
+		XNextEvent(xd->display, &xev);
+		if (xev.type == MappingNotify)
+		{
+			XRefreshKeyboardMapping(&xev.xmapping);
+			continue;
+		}
+		/* a window we are sending a selection to, which may be
+		 * one of ours pasting it */
+		if (!LIST_EMPTY(&xd->incrs))
+			xdisplay_incr_event(xd, &xev);
+		/* every other event we select is for (or, for
+		 * GraphicsExpose and NoExpose, in) the window */
+		if ((c = xdisplay_client(xd, xev.xany.window)))
+			xtmux_event(&c->tty, &xev);
+	}
+
+	TAILQ_FOREACH(c, &clients, entry)
+		if (c->tty.xtmux && c->tty.xtmux->xd == xd && c->tty.flags & TTY_OPENED)
+			xtmux_main(&c->tty);
+}
+
 static void
 xdisplay_connection_callback(int fd, short events, void *data)
 {
-	struct tty *tty = data;
+	struct xdisplay *xd = data;
 
 	if (events & EV_READ)
 	{
-		XENTRY();
-		XProcessInternalConnection(tty->xtmux->display, fd);
-		xtmux_main(tty);
+		XDENTRY();
+		XProcessInternalConnection(xd->display, fd);
+		xdisplay_main(xd);
 		XRETURN_();
 	}
 }
@@ -291,13 +648,13 @@ xdisplay_connection_callback(int fd, short events, void *data)
 static void
 xdisplay_connection_watch(__unused Display *display, XPointer data, int fd, Bool opening, XPointer *watch_data)
 {
-	struct tty *tty = (struct tty *)data;
+	struct xdisplay *xd = (struct xdisplay *)data;
 	struct event *ev;
 
 	if (opening)
 	{
 		ev = xmalloc(sizeof *ev);
-		event_set(ev, fd, EV_READ|EV_PERSIST, xdisplay_connection_callback, tty);
+		event_set(ev, fd, EV_READ|EV_PERSIST, xdisplay_connection_callback, xd);
 		if (event_add(ev, NULL) < 0)
 			fatal("failed to add display X connection");
 		*watch_data = (XPointer)ev;
@@ -313,13 +670,188 @@ xdisplay_connection_watch(__unused Display *display, XPointer data, int fd, Bool
 static void
 xdisplay_callback(__unused int fd, __unused short events, void *data)
 {
-	struct tty *tty = (struct tty *)data;
+	struct xdisplay *xd = data;
 
-	XENTRY();
-	xtmux_main(tty);
+	XDENTRY();
+	xdisplay_main(xd);
 	XRETURN_();
 }
 
+/* precompute the pixel value of each channel level from the visual masks */
+static void
+xdisplay_rgb_setup(struct xdisplay *xd)
+{
+	unsigned long masks[3] = {
+		xd->visual->red_mask,
+		xd->visual->green_mask,
+		xd->visual->blue_mask
+	};
+	unsigned long m;
+	u_int i, v, shift;
+
+	xd->rgb = xcalloc(3 * 256, sizeof *xd->rgb);
+	for (i = 0; i < 3; i ++)
+	{
+		if (!(m = masks[i]))
+			continue;
+		for (shift = 0; !(m & 1); shift ++)
+			m >>= 1;
+		for (v = 0; v < 256; v ++)
+			xd->rgb[256*i + v] = ((v * m + 127) / 255) << shift;
+	}
+}
+
+/* allocate a colour for an RGB value, until the cache is full: colours are
+ * never freed, since cells already drawn in one would change if the server
+ * handed it out again */
+static int
+xdisplay_alloc_rgb(struct xdisplay *xd, u_int rgb, unsigned long *pixel)
+{
+	struct rgb_pixel *p, *slot = NULL;
+	XColor c;
+
+	for (p = xd->rgb_cache; p < &xd->rgb_cache[XTMUX_RGB_CACHE]; p ++)
+	{
+		if (p->used && p->rgb == rgb)
+		{
+			*pixel = p->pixel;
+			return 1;
+		}
+		if (!p->used && !slot)
+			slot = p;
+	}
+
+	if (!slot)
+		return 0;
+	c.red   = (rgb >> 16 & 0xff) * 0x101;
+	c.green = (rgb >> 8 & 0xff) * 0x101;
+	c.blue  = (rgb & 0xff) * 0x101;
+	if (!XAllocColor(xd->display, DefaultColormap(xd->display, DefaultScreen(xd->display)), &c))
+		return 0;
+	slot->rgb = rgb;
+	slot->pixel = *pixel = c.pixel;
+	slot->used = 1;
+	return 1;
+}
+
+/* get a connection to the named display, opening it if there is none yet */
+static struct xdisplay *
+xdisplay_open(const char *name)
+{
+	struct xdisplay *xd;
+	Display *display;
+	XVisualInfo visual_mask = {
+		.depth = 24,
+		.class = TrueColor,
+		.red_mask   = 0xff0000,
+		.green_mask = 0x00ff00,
+		.blue_mask  = 0x0000ff
+	};
+	XVisualInfo *visual;
+	XGCValues gc_values;
+	Pixmap p;
+	int n;
+
+	LIST_FOREACH(xd, &xdisplays, entry)
+		if (!xd->ioerror && !strcmp(xd->name, name))
+		{
+			xd->references ++;
+			return xd;
+		}
+
+	display = XOpenDisplay(name);
+	if (!display)
+		return NULL;
+
+	xd = xcalloc(1, sizeof *xd);
+	xd->name = xstrdup(name);
+	xd->references = 1;
+	xd->display = display;
+	LIST_INIT(&xd->fonts);
+	LIST_INIT(&xd->palettes);
+	LIST_INIT(&xd->incrs);
+	LIST_INSERT_HEAD(&xdisplays, xd, entry);
+
+	event_set(&xd->event, ConnectionNumber(display), EV_READ|EV_PERSIST, xdisplay_callback, xd);
+	if (event_add(&xd->event, NULL) < 0)
+		fatal("failed to add X display event");
+
+	if (!XAddConnectionWatch(display, &xdisplay_connection_watch, (XPointer)xd))
+		fprintf(stderr, "xtmux: could not watch X display connections: %s\n", name);
+
+	visual_mask.screen = DefaultScreen(display);
+	visual = XGetVisualInfo(display, VisualScreenMask | VisualDepthMask | VisualClassMask | VisualRedMaskMask | VisualGreenMaskMask | VisualBlueMaskMask, &visual_mask, &n);
+	xd->visual = visual ? visual->visual : DefaultVisual(display, DefaultScreen(display));
+	xd->depth = visual ? visual->depth : DefaultDepth(display, DefaultScreen(display));
+	if (visual)
+		XFree(visual);
+	/* else should not use RGB... */
+	if (xd->visual->class == TrueColor)
+		xdisplay_rgb_setup(xd);
+
+	/* GCs must match the depth of the windows they are used with */
+	p = XCreatePixmap(display, DefaultRootWindow(display), 1, 1, xd->depth);
+
+	gc_values.graphics_exposures = True;
+	xd->gc = XCreateGC(display, p, GCGraphicsExposures, &gc_values);
+
+	gc_values.foreground = WhitePixel(display, DefaultScreen(display));
+	gc_values.background = BlackPixel(display, DefaultScreen(display));
+	gc_values.function = GXxor; /* this'll be fine for TrueColor, etc, but we might want to avoid PseudoColor for this */
+	gc_values.graphics_exposures = False;
+	xd->cursor_gc = XCreateGC(display, p, GCFunction | GCForeground | GCBackground | GCGraphicsExposures, &gc_values);
+
+	xd->buffer_gc = XCreateGC(display, p, GCGraphicsExposures, &gc_values);
+
+	XFreePixmap(display, p);
+
+	xd->atom_incr = XInternAtom(display, "INCR", False);
+	xd->atom_utf8_string = XInternAtom(display, "UTF8_STRING", False);
+	xd->atom_targets = XInternAtom(display, "TARGETS", False);
+	xd->atom_text = XInternAtom(display, "TEXT", False);
+	/* a quarter of the largest request, as other clients tend to use */
+	xd->selection_chunk = XMaxRequestSize(display);
+
+	return xd;
+}
+
+static void
+xdisplay_close(struct xdisplay *xd)
+{
+	int fd;
+
+	if (-- xd->references)
+		return;
+
+	event_del(&xd->event);
+
+	while (!LIST_EMPTY(&xd->incrs))
+		xdisplay_incr_free(xd, LIST_FIRST(&xd->incrs));
+
+	if (!xd->ioerror)
+	{
+		XFreeGC(xd->display, xd->gc);
+		XFreeGC(xd->display, xd->cursor_gc);
+		XFreeGC(xd->display, xd->buffer_gc);
+#if defined(HAVE_XRENDER) || defined(HAVE_XSHM)
+		if (xd->glyph_gc != None)
+			XFreeGC(xd->display, xd->glyph_gc);
+		if (xd->glyph_pixmap != None)
+			XFreePixmap(xd->display, xd->glyph_pixmap);
+#endif
+	}
+
+	fd = ConnectionNumber(xd->display);
+	XCloseDisplay(xd->display);
+	/* if ioerror, sometimes connection is left open; should be safe regardless */
+	close(fd);
+
+	LIST_REMOVE(xd, entry);
+	free(xd->rgb);
+	free(xd->name);
+	free(xd);
+}
+
 static unsigned long
 xt_parse_color(struct xtmux *x, const char *s, unsigned long def)
 {
@@ -350,6 +882,12 @@ xt_fill_color(struct xtmux *x, u_int i)
 	XColor c;
 	u_char r, g, b;
 	colour_256rgb(i, &r, &g, &b);
+	if (x->xd->rgb)
+	{
+		/* nothing to allocate in a TrueColor colormap */
+		x->colors[i] = x->xd->rgb[r] | x->xd->rgb[256 + g] | x->xd->rgb[512 + b];
+		return;
+	}
 	c.red   = r << 8 | r;
 	c.green = g << 8 | g;
 	c.blue  = b << 8 | b;
@@ -358,12 +896,55 @@ xt_fill_color(struct xtmux *x, u_int i)
 	x->colors[i] = c.pixel;
 }
 
+static void
+xt_free_colors(struct xtmux *x)
+{
+	struct palette *p = x->palette;
+
+	if (!p)
+		return;
+	x->palette = NULL;
+	x->colors = NULL;
+	if (-- p->references)
+		return;
+	/* TrueColor colours are never really allocated, so need no freeing */
+	if (!x->ioerror && !x->xd->rgb)
+		XFreeColors(x->display, XCOLORMAP, p->colors, XTMUX_NUM_COLORS, 0);
+	LIST_REMOVE(p, entry);
+	free(p->spec);
+	free(p);
+}
+
+/* use the palette for xtmux-colors, allocating it if no window on the display has */
 static void
 xt_fill_colors(struct xtmux *x, const char *colors)
 {
+	struct palette *p;
 	u_int c;
 	char *s, *cs, *cn;
 
+	if (x->palette && !strcmp(x->palette->spec, colors))
+		return;
+
+	LIST_FOREACH(p, &x->xd->palettes, entry)
+		if (!strcmp(p->spec, colors))
+			break;
+	if (p)
+	{
+		p->references ++;
+		xt_free_colors(x);
+		x->palette = p;
+		x->colors = p->colors;
+		return;
+	}
+
+	xt_free_colors(x);
+	p = x->palette = xcalloc(1, sizeof *p);
+	p->spec = xstrdup(colors);
+	p->references = 1;
+	LIST_INSERT_HEAD(&x->xd->palettes, p, entry);
+	x->colors = p->colors;
+
 	for (c = 0; c < 256; c ++)
 		xt_fill_color(x, c);
 
@@ -392,6 +973,13 @@ xt_fill_cursor(struct xtmux *x, u_int cstyle)
 
 	if (!x->cursor)
 		x->cursor = XCreatePixmap(x->display, DefaultRootWindow(x->display), w, h, 1);
+#ifdef HAVE_XSHM
+	if (x->cursor_image)
+	{
+		XDestroyImage(x->cursor_image);
+		x->cursor_image = NULL;
+	}
+#endif
 
 	gc = XCreateGC(x->display, x->cursor, 0, NULL);
 	XSetForeground(x->display, gc, 0);
@@ -408,7 +996,7 @@ xt_fill_cursor(struct xtmux *x, u_int cstyle)
 	switch (cstyle)
 	{
 		/* based on http://invisible-island.net/xterm/ctlseqs/ctlseqs.html
-		 * we don't (bother to) support blinking yet */
+		 * odd styles blink, see xt_cursor_blinks */
 		default:
 		case 1: /* block (blinking) */
 		case 2: /* block (steady) */
@@ -478,63 +1066,51 @@ font_name_set(const char *f, unsigned seg, const char *r)
 	return out;
 }
 
-static int
-xt_load_font(struct xtmux *x, enum font_type type, const char *name)
+
+static void
+xt_font_map_clear(struct xtmux *x)
 {
-	struct font *font = &x->font[type];
-	XFontStruct *fs;
+	u_int t, i;
+
+	for (t = 0; t < FONT_TYPE_COUNT; t ++)
+	{
+		for (i = 0; i < nitems(x->font_map[t]); i ++)
+		{
+			free(x->font_map[t][i]);
+			x->font_map[t][i] = NULL;
+		}
+		for (i = 0; i < nitems(x->low_map[t]); i ++)
+		{
+			free(x->low_map[t][i]);
+			x->low_map[t][i] = NULL;
+		}
+	}
+}
+
+static struct font_info *
+font_info_new(struct xdisplay *xd, const char *name, XFontStruct *fs)
+{
+	struct font_info *info;
 	unsigned long nameatom;
 	wchar r, c, w = 0;
 	unsigned i, n;
 
-	if (!name)
-		return -1;
-	fs = XLoadQueryFont(x->display, name);
-	if (!fs)
-	{
-		fprintf(stderr, "font not found: %s\n", name);
-		return -1;
-	}
-	if (fs->fid == font->fid)
-	{
-		/* no change */
-		XFreeFont(x->display, fs);
-		return 0;
-	}
-	if (font->fid)
-	{
-		XUnloadFont(x->display, font->fid);
-		font->fid = None;
-		free(font->name);
-		font->name = NULL;
-		font->char_max = 0;
-	}
-	if (!type)
-	{
-		x->cw = fs->max_bounds.width;
-		x->ch = fs->ascent + fs->descent;
-	}
-	else if (x->cw != fs->max_bounds.width ||
-			x->ch != fs->ascent + fs->descent)
-	{
-		fprintf(stderr, "font extents mismatch: %s\n", name);
-		XFreeFont(x->display, fs);
-		return -1;
-	}
-	font->fid = fs->fid;
+	info = xcalloc(1, sizeof *info);
+	info->display = xstrdup(xd->name);
+	info->request = xstrdup(name);
+	info->width = fs->max_bounds.width;
 	if (XGetFontProperty(fs, XA_FONT, &nameatom))
 	{
-		char *fn = XGetAtomName(x->display, nameatom);
-		font->name = xstrdup(fn);
+		char *fn = XGetAtomName(xd->display, nameatom);
+		info->name = xstrdup(fn);
 		XFree(fn);
 	}
 	else
-		font->name = xstrdup(name);
-	font->ascent = fs->ascent;
-	font->descent = fs->descent;
-	font->char_max = (fs->max_byte1 << 8) + fs->max_char_or_byte2;
-	font->char_mask = xreallocarray(font->char_mask, FONT_CHAR_OFF(font->char_max)+1, sizeof *font->char_mask);
-	memset(font->char_mask, 0, (sizeof *font->char_mask)*(FONT_CHAR_OFF(font->char_max)+1));
+		info->name = xstrdup(name);
+	info->ascent = fs->ascent;
+	info->descent = fs->descent;
+	info->char_max = (fs->max_byte1 << 8) + fs->max_char_or_byte2;
+	info->char_mask = xcalloc(FONT_CHAR_OFF(info->char_max)+1, sizeof *info->char_mask);
 
 	i = n = 0;
 	for (r = fs->min_byte1; r <= fs->max_byte1; r ++)
@@ -547,46 +1123,939 @@ xt_load_font(struct xtmux *x, enum font_type type, const char *name)
 					cs->ascent != 0 || cs->descent != 0)
 			{
 				w = (r << 8) + c;
-				font->char_mask[FONT_CHAR_OFF(w)] |= FONT_CHAR_BIT(w);
+				info->char_mask[FONT_CHAR_OFF(w)] |= FONT_CHAR_BIT(w);
 				n ++;
 			}
 		}
 
 	/* trim */
-	font->char_max = w;
-	font->char_mask = xreallocarray(font->char_mask, FONT_CHAR_OFF(font->char_max)+1, sizeof *font->char_mask);
-
-	log_debug("font loaded with %u/%u characters: %s", n, i, font->name);
-	XFreeFontInfo(NULL, fs, 1);
-	return 1;
-}
+	info->char_max = w;
+	info->char_mask = xreallocarray(info->char_mask, FONT_CHAR_OFF(info->char_max)+1, sizeof *info->char_mask);
 
-static void
-xt_free_font(struct xtmux *x, enum font_type type)
-{
-	struct font *font = &x->font[type];
-	if (!x->ioerror && font->fid != None)
-		XUnloadFont(x->display, font->fid);
-	font->fid = None;
-	free(font->name);
-	font->name = NULL;
-	font->char_max = 0;
-	free(font->char_mask);
-	font->char_mask = NULL;
+	log_debug("font loaded with %u/%u characters: %s", n, i, info->name);
+	LIST_INSERT_HEAD(&font_infos, info, entry);
+	return info;
 }
 
-static inline int
-xt_font_has_char(const struct xtmux *x, enum font_type type, wchar c)
+/* get a font from those loaded on the display, loading it if needed */
+static struct font *
+xdisplay_font(struct xdisplay *xd, const char *name)
 {
-	const struct font *font = &x->font[type];
-	if (!font)
-		return 0;
-	if (c > font->char_max)
-		return 0;
-	if (font->char_mask[FONT_CHAR_OFF(c)] & FONT_CHAR_BIT(c))
-		return 1;
-	return 0;
-}
+	struct font *font;
+	struct font_info *info;
+	XFontStruct *fs;
+	Font fid;
+	char **names;
+	int n;
+
+	LIST_FOREACH(font, &xd->fonts, entry)
+		if (!strcmp(font->request, name))
+		{
+			font->references ++;
+			return font;
+		}
+
+	LIST_FOREACH(info, &font_infos, entry)
+		if (!strcmp(info->display, xd->name) && !strcmp(info->request, name))
+			break;
+	if (info)
+	{
+		/* seen before: only check it is there, without the
+		 * per-character reply */
+		names = XListFonts(xd->display, name, 1, &n);
+		if (!names)
+		{
+			fprintf(stderr, "font not found: %s\n", name);
+			return NULL;
+		}
+		XFreeFontNames(names);
+		fid = XLoadFont(xd->display, name);
+	}
+	else
+	{
+		fs = XLoadQueryFont(xd->display, name);
+		if (!fs)
+		{
+			fprintf(stderr, "font not found: %s\n", name);
+			return NULL;
+		}
+		info = font_info_new(xd, name, fs);
+		fid = fs->fid;
+		XFreeFontInfo(NULL, fs, 1);
+	}
+
+	font = xcalloc(1, sizeof *font);
+	font->request = xstrdup(name);
+	font->references = 1;
+	font->fid = fid;
+	font->name = info->name;
+	font->ascent = info->ascent;
+	font->descent = info->descent;
+	font->width = info->width;
+	font->char_max = info->char_max;
+	font->char_mask = info->char_mask;
+	LIST_INSERT_HEAD(&xd->fonts, font, entry);
+	return font;
+}
+
+static void
+xdisplay_font_free(struct xdisplay *xd, struct font *font)
+{
+#ifdef HAVE_XSHM
+	u_int i;
+
+#endif
+	if (-- font->references)
+		return;
+
+	if (!xd->ioerror)
+	{
+		XUnloadFont(xd->display, font->fid);
+#ifdef HAVE_XRENDER
+		if (font->glyphs != None)
+			XRenderFreeGlyphSet(xd->display, font->glyphs);
+#endif
+	}
+#ifdef HAVE_XRENDER
+	free(font->glyph_mask);
+#endif
+#ifdef HAVE_XSHM
+	for (i = 0; i < nitems(font->atlas); i ++)
+		free(font->atlas[i]);
+	free(font->atlas_mask);
+#endif
+	free(font->request);
+	LIST_REMOVE(font, entry);
+	free(font);
+}
+
+static int
+xt_load_font(struct xtmux *x, u_int type, const char *name)
+{
+	struct font *font;
+
+	if (!name)
+		return -1;
+	font = xdisplay_font(x->xd, name);
+	if (!font)
+		return -1;
+	if (font == x->font[type])
+	{
+		/* no change */
+		xdisplay_font_free(x->xd, font);
+		return 0;
+	}
+	if (!type)
+	{
+		x->cw = font->width;
+		x->ch = font->ascent + font->descent;
+	}
+	else if ((font->width != x->cw &&
+				(type < FONT_TYPE_COUNT || font->width != 2*x->cw)) ||
+			font->ascent + font->descent != x->ch)
+	{
+		fprintf(stderr, "font extents mismatch: %s\n", name);
+		xdisplay_font_free(x->xd, font);
+		return -1;
+	}
+	if (x->font[type])
+		xdisplay_font_free(x->xd, x->font[type]);
+	x->font[type] = font;
+	xt_font_map_clear(x);
+	return 1;
+}
+
+static void
+xt_free_font(struct xtmux *x, u_int type)
+{
+	if (!x->font[type])
+		return;
+	xt_font_map_clear(x);
+	xdisplay_font_free(x->xd, x->font[type]);
+	x->font[type] = NULL;
+}
+
+/* load the font for a style as set in the options, or derived from the base font */
+static void
+xt_load_style(struct xtmux *x, u_int type)
+{
+	struct options *o = x->client->options;
+	const struct font *italic;
+	const char *font;
+	int r;
+
+	x->style_pending &= ~(1 << type);
+	switch (type)
+	{
+		case FONT_TYPE_BOLD:
+			if (*(font = options_get_string(o, "xtmux-bold-font")))
+				r = xt_load_font(x, type, font);
+			else
+				r = xt_load_font(x, type, font_name_set(x->font[0]->name, 3, "bold"));
+			break;
+		case FONT_TYPE_ITALIC:
+			if (*(font = options_get_string(o, "xtmux-italic-font")))
+				r = xt_load_font(x, type, font);
+			else if ((r = xt_load_font(x, type, font_name_set(x->font[0]->name, 4, "o"))) < 0)
+				r = xt_load_font(x, type, font_name_set(x->font[0]->name, 4, "i"));
+			break;
+		case FONT_TYPE_BOLD_ITALIC:
+			/* falls back on both of these for missing characters */
+			italic = xt_style_font(x, FONT_TYPE_ITALIC);
+			xt_style_font(x, FONT_TYPE_BOLD);
+			if (*(font = options_get_string(o, "xtmux-bold-italic-font")))
+				r = xt_load_font(x, type, font);
+			else
+				r = xt_load_font(x, type, font_name_set(italic ? italic->name : NULL, 3, "bold"));
+			break;
+		default:
+			return;
+	}
+	if (r < 0)
+		xt_free_font(x, type);
+}
+
+static struct font *
+xt_style_font(struct xtmux *x, u_int type)
+{
+	if (x->style_pending & (1 << type))
+		xt_load_style(x, type);
+	return x->font[type];
+}
+
+/* whether a font draws across two cells */
+static inline int
+xt_font_wide(const struct xtmux *x, u_int type)
+{
+	return x->font[type]->width > x->cw;
+}
+
+static inline int
+xt_font_has_char(const struct xtmux *x, u_int type, wchar c)
+{
+	const struct font *font = x->font[type];
+	if (!font)
+		return 0;
+	if (c > font->char_max)
+		return 0;
+	if (font->char_mask[FONT_CHAR_OFF(c)] & FONT_CHAR_BIT(c))
+		return 1;
+	return 0;
+}
+
+#if defined(HAVE_XRENDER) || defined(HAVE_XSHM)
+/* draw some characters with the core font and read them back, each into
+ * stride*height bytes of data, 0xff where set */
+static void
+xdisplay_raster_glyphs(struct xdisplay *xd, struct font *font, const u_short *cs, u_int n, u_char *data, u_int stride)
+{
+	XImage *img;
+	XChar2b c2;
+	XRectangle clip;
+	u_int gw = font->width;
+	u_int gh = font->ascent + font->descent;
+	size_t size = stride * gh;
+	u_int i, gx, gy;
+
+	if (xd->glyph_pixmap == None || xd->glyph_w < GLYPH_BATCH*gw || xd->glyph_h < gh)
+	{
+		if (xd->glyph_pixmap != None)
+			XFreePixmap(xd->display, xd->glyph_pixmap);
+		if (xd->glyph_w < GLYPH_BATCH*gw)
+			xd->glyph_w = GLYPH_BATCH*gw;
+		if (xd->glyph_h < gh)
+			xd->glyph_h = gh;
+		xd->glyph_pixmap = XCreatePixmap(xd->display, DefaultRootWindow(xd->display), xd->glyph_w, xd->glyph_h, 1);
+		if (xd->glyph_gc == None)
+			xd->glyph_gc = XCreateGC(xd->display, xd->glyph_pixmap, 0, NULL);
+	}
+
+	XSetForeground(xd->display, xd->glyph_gc, 0);
+	XFillRectangle(xd->display, xd->glyph_pixmap, xd->glyph_gc, 0, 0, n*gw, gh);
+	XSetForeground(xd->display, xd->glyph_gc, 1);
+	XSetFont(xd->display, xd->glyph_gc, font->fid);
+	/* ink past the cell (italics, negative lbearing) must not land in the next one */
+	clip.x = clip.y = 0;
+	clip.width = gw;
+	clip.height = gh;
+	XSetClipRectangles(xd->display, xd->glyph_gc, 0, 0, &clip, 1, Unsorted);
+	for (i = 0; i < n; i ++)
+	{
+		c2.byte1 = cs[i] >> 8;
+		c2.byte2 = cs[i];
+		XSetClipOrigin(xd->display, xd->glyph_gc, i*gw, 0);
+		XDrawString16(xd->display, xd->glyph_pixmap, xd->glyph_gc, i*gw, font->ascent, &c2, 1);
+	}
+	XSetClipMask(xd->display, xd->glyph_gc, None);
+
+	img = XGetImage(xd->display, xd->glyph_pixmap, 0, 0, n*gw, gh, 1, ZPixmap);
+	if (!img)
+		return;
+
+	for (i = 0; i < n; i ++)
+		for (gy = 0; gy < gh; gy ++)
+			for (gx = 0; gx < gw; gx ++)
+				if (XGetPixel(img, i*gw + gx, gy))
+					data[i*size + gy*stride + gx] = 0xff;
+	XDestroyImage(img);
+}
+#endif
+
+#ifdef HAVE_XRENDER
+static u_short
+xt_mask_value(unsigned long p, unsigned long m)
+{
+	if (!m)
+		return 0;
+	while (!(m & 1))
+	{
+		m >>= 1;
+		p >>= 1;
+	}
+	return (p & m) * 0xffff / m;
+}
+
+static void
+xt_render_color(const struct xtmux *x, unsigned long pixel, XRenderColor *rc)
+{
+	rc->red   = xt_mask_value(pixel, x->visual->red_mask);
+	rc->green = xt_mask_value(pixel, x->visual->green_mask);
+	rc->blue  = xt_mask_value(pixel, x->visual->blue_mask);
+	rc->alpha = 0xffff;
+}
+
+/* solid fill source for the given color, from a small cache */
+static Picture
+xt_render_pen(struct xtmux *x, unsigned long pixel)
+{
+	struct pen *p = &x->pens[(pixel ^ pixel >> 8 ^ pixel >> 16) % XTMUX_NUM_PENS];
+	XRenderColor rc;
+
+	if (p->fill != None)
+	{
+		if (p->pixel == pixel)
+			return p->fill;
+		XRenderFreePicture(x->display, p->fill);
+	}
+	xt_render_color(x, pixel, &rc);
+	p->pixel = pixel;
+	p->fill = XRenderCreateSolidFill(x->display, &rc);
+	return p->fill;
+}
+
+/* rasterize some characters with the core font and add them to the font's glyph set */
+static void
+xdisplay_add_glyphs(struct xdisplay *xd, struct font *font, const Glyph *gids, u_int n)
+{
+	XGlyphInfo info[GLYPH_BATCH];
+	u_int gw = font->width;
+	u_int gh = font->ascent + font->descent;
+	u_int stride = (gw + 3) & ~3;
+	size_t size = stride * gh;
+	u_short cs[GLYPH_BATCH];
+	char *data;
+	u_int i;
+
+	data = xcalloc(n, size);
+	for (i = 0; i < n; i ++)
+	{
+		info[i].width = gw;
+		info[i].height = gh;
+		info[i].x = 0;
+		info[i].y = 0;
+		info[i].xOff = gw;
+		info[i].yOff = 0;
+		cs[i] = gids[i];
+	}
+	xdisplay_raster_glyphs(xd, font, cs, n, (u_char *)data, stride);
+
+	XRenderAddGlyphs(xd->display, font->glyphs, gids, info, n, data, n*size);
+	free(data);
+}
+
+/* make sure the given characters are available in the font's glyph set */
+static void
+xt_render_load_glyphs(struct xtmux *x, u_int type, const u_short *cp, size_t n)
+{
+	struct font *font = x->font[type];
+	Glyph gids[GLYPH_BATCH];
+	u_int k = 0;
+	size_t i;
+
+	if (font->glyphs == None)
+	{
+		font->glyphs = XRenderCreateGlyphSet(x->display, x->glyph_format);
+		font->glyph_mask = xcalloc(FONT_CHAR_OFF((u_short)-1)+1, sizeof *font->glyph_mask);
+	}
+
+	for (i = 0; i < n; i ++)
+	{
+		u_short c = cp[i];
+
+		if (font->glyph_mask[FONT_CHAR_OFF(c)] & FONT_CHAR_BIT(c))
+			continue;
+		font->glyph_mask[FONT_CHAR_OFF(c)] |= FONT_CHAR_BIT(c);
+		gids[k++] = c;
+		if (k == GLYPH_BATCH)
+		{
+			xdisplay_add_glyphs(x->xd, font, gids, k);
+			k = 0;
+		}
+	}
+	if (k)
+		xdisplay_add_glyphs(x->xd, font, gids, k);
+}
+
+static void
+xt_render_free(struct xtmux *x)
+{
+	u_int i;
+
+	/* glyph sets stay with their fonts */
+	for (i = 0; i < XTMUX_NUM_PENS; i ++)
+	{
+		if (!x->ioerror && x->pens[i].fill != None)
+			XRenderFreePicture(x->display, x->pens[i].fill);
+		x->pens[i].fill = None;
+	}
+
+	if (x->picture != None)
+	{
+		if (!x->ioerror)
+			XRenderFreePicture(x->display, x->picture);
+		x->picture = None;
+	}
+}
+
+/* switch between core and xrender drawing according to xtmux-renderer */
+static void
+xt_render_setup(struct tty *tty)
+{
+	struct xtmux *x = tty->xtmux;
+	int render, event_base, error_base;
+	XRenderPictFormat *format;
+
+	switch (options_get_number(tty->client->options, "xtmux-renderer"))
+	{
+		case XTMUX_RENDERER_XRENDER:
+			render = 1;
+			break;
+		case XTMUX_RENDERER_SHM:
+			/* instead, if that could not be set up */
+#ifdef HAVE_XSHM
+			render = x->image == NULL;
+#else
+			render = 1;
+#endif
+			break;
+		default:
+			render = 0;
+	}
+	if (render == (x->picture != None))
+		return;
+	if (!render)
+	{
+		xt_render_free(x);
+		return;
+	}
+
+	if (!XRenderQueryExtension(x->display, &event_base, &error_base))
+	{
+		log_debug("XRender not available; using core drawing");
+		return;
+	}
+	format = XRenderFindVisualFormat(x->display, x->visual);
+	x->glyph_format = XRenderFindStandardFormat(x->display, PictStandardA8);
+	if (!format || format->type != PictTypeDirect || !x->glyph_format)
+	{
+		log_debug("XRender format not supported; using core drawing");
+		return;
+	}
+	x->picture = XRenderCreatePicture(x->display, x->draw, format, 0, NULL);
+}
+
+/* recreate the render target after x->draw changes */
+static void
+xt_render_retarget(struct xtmux *x)
+{
+	if (x->picture == None)
+		return;
+	XRenderFreePicture(x->display, x->picture);
+	x->picture = XRenderCreatePicture(x->display, x->draw,
+			XRenderFindVisualFormat(x->display, x->visual), 0, NULL);
+}
+#endif
+
+#ifdef HAVE_XSHM
+static int xt_shm_error_code;
+
+static int
+xt_shm_error(__unused Display *disp, XErrorEvent *e)
+{
+	xt_shm_error_code = e->error_code;
+	return 0;
+}
+
+/* an image in memory shared with the server, or NULL if it cannot have one */
+static XImage *
+xt_shm_create(struct xtmux *x, XShmSegmentInfo *shm, u_int w, u_int h)
+{
+	static const union { uint32_t i; u_char c; } order = { 1 };
+	int (*handler)(Display *, XErrorEvent *);
+	XImage *img;
+
+	img = XShmCreateImage(x->display, x->visual, x->depth, ZPixmap, NULL, shm, w, h);
+	if (!img)
+		return NULL;
+	/* pixels are written as they are in memory here */
+	if (img->bits_per_pixel != 32 || img->byte_order != (order.c ? LSBFirst : MSBFirst))
+	{
+		XDestroyImage(img);
+		return NULL;
+	}
+
+	shm->shmid = shmget(IPC_PRIVATE, (size_t)img->bytes_per_line * h, IPC_CREAT | 0600);
+	if (shm->shmid < 0)
+	{
+		XDestroyImage(img);
+		return NULL;
+	}
+	shm->shmaddr = img->data = shmat(shm->shmid, NULL, 0);
+	shm->readOnly = False;
+	if (shm->shmaddr == (char *)-1)
+	{
+		shmctl(shm->shmid, IPC_RMID, NULL);
+		img->data = NULL;
+		XDestroyImage(img);
+		return NULL;
+	}
+
+	/* a remote server refuses, which should not end the client */
+	XSync(x->display, False);
+	xt_shm_error_code = 0;
+	handler = XSetErrorHandler(xt_shm_error);
+	XShmAttach(x->display, shm);
+	XSync(x->display, False);
+	XSetErrorHandler(handler);
+	/* removed once both sides have detached */
+	shmctl(shm->shmid, IPC_RMID, NULL);
+	if (xt_shm_error_code)
+	{
+		shmdt(shm->shmaddr);
+		img->data = NULL;
+		XDestroyImage(img);
+		return NULL;
+	}
+	return img;
+}
+
+static void
+xt_shm_destroy(struct xtmux *x, XImage *img, XShmSegmentInfo *shm)
+{
+	if (!x->ioerror)
+		XShmDetach(x->display, shm);
+	shmdt(shm->shmaddr);
+	img->data = NULL;
+	XDestroyImage(img);
+}
+
+static void
+xt_shm_free(struct xtmux *x)
+{
+	if (x->cursor_image)
+	{
+		XDestroyImage(x->cursor_image);
+		x->cursor_image = NULL;
+	}
+	if (x->image)
+	{
+		xt_shm_destroy(x, x->image, &x->shm);
+		x->image = NULL;
+	}
+}
+
+static inline uint32_t *
+xt_image_row(const struct xtmux *x, u_int px, u_int py)
+{
+	return (uint32_t *)(x->image->data + (size_t)py * x->image->bytes_per_line) + px;
+}
+
+/* clip a pixel rectangle to the image, returning 0 if nothing is left */
+static int
+xt_image_clip(const struct xtmux *x, u_int px, u_int py, u_int *w, u_int *h)
+{
+	u_int iw = x->image->width, ih = x->image->height;
+
+	if (px >= iw || py >= ih)
+		return 0;
+	if (*w > iw - px)
+		*w = iw - px;
+	if (*h > ih - py)
+		*h = ih - py;
+	return *w && *h;
+}
+
+static void
+xt_image_fill(struct xtmux *x, unsigned long pixel, u_int px, u_int py, u_int w, u_int h)
+{
+	uint32_t *p;
+	u_int i;
+
+	if (!xt_image_clip(x, px, py, &w, &h))
+		return;
+	for (; h --; py ++)
+		for (p = xt_image_row(x, px, py), i = 0; i < w; i ++)
+			p[i] = pixel;
+}
+
+static void
+xt_image_copy(struct xtmux *x, u_int px1, u_int py1, u_int px2, u_int py2, u_int w, u_int h)
+{
+	u_int i;
+
+	if (!xt_image_clip(x, px1, py1, &w, &h) || !xt_image_clip(x, px2, py2, &w, &h))
+		return;
+	/* rows in the order that does not overwrite ones still to be moved */
+	for (i = 0; i < h; i ++)
+	{
+		u_int r = py2 > py1 ? h-1 - i : i;
+
+		memmove(xt_image_row(x, px2, py2 + r), xt_image_row(x, px1, py1 + r), w * sizeof(uint32_t));
+	}
+}
+
+/* grow the image to cover at least the given size, keeping its contents */
+static int
+xt_shm_resize(struct xtmux *x, u_int w, u_int h)
+{
+	XImage *old = x->image;
+	XShmSegmentInfo shm;
+	u_int y, ow = 0, oh = 0;
+
+	if (old)
+	{
+		ow = old->width;
+		oh = old->height;
+		if (w <= ow && h <= oh)
+			return 1;
+		if (w < ow)
+			w = ow;
+		if (h < oh)
+			h = oh;
+	}
+
+	x->image = xt_shm_create(x, &shm, w, h);
+	if (!x->image)
+	{
+		x->image = old;
+		return 0;
+	}
+	xt_image_fill(x, x->bg, 0, 0, w, h);
+	if (old)
+	{
+		for (y = 0; y < oh; y ++)
+			memcpy(xt_image_row(x, 0, y), old->data + (size_t)y * old->bytes_per_line,
+					ow * sizeof(uint32_t));
+		xt_shm_destroy(x, old, &x->shm);
+	}
+	x->shm = shm;
+	return 1;
+}
+
+/* make sure the given characters are in the font's atlas */
+static void
+xt_shm_load_glyphs(struct xtmux *x, u_int type, const XChar2b *c2, size_t n)
+{
+	struct font *font = x->font[type];
+	size_t size = (size_t)font->width * (font->ascent + font->descent);
+	u_short cs[GLYPH_BATCH];
+	u_char *data;
+	u_int i, k = 0;
+	size_t j;
+
+	if (!font->atlas_mask)
+		font->atlas_mask = xcalloc(FONT_CHAR_OFF((u_short)-1)+1, sizeof *font->atlas_mask);
+
+	for (j = 0; j <= n; j ++)
+	{
+		if (j < n)
+		{
+			u_short c = c2[j].byte1 << 8 | c2[j].byte2;
+
+			if (font->atlas_mask[FONT_CHAR_OFF(c)] & FONT_CHAR_BIT(c))
+				continue;
+			font->atlas_mask[FONT_CHAR_OFF(c)] |= FONT_CHAR_BIT(c);
+			cs[k++] = c;
+			if (k < GLYPH_BATCH)
+				continue;
+		}
+		if (!k)
+			continue;
+
+		data = xcalloc(k, size);
+		xdisplay_raster_glyphs(x->xd, font, cs, k, data, font->width);
+		for (i = 0; i < k; i ++)
+		{
+			u_char **block = &font->atlas[cs[i] >> 8];
+
+			if (!*block)
+				*block = xcalloc(256, size);
+			memcpy(*block + (cs[i] & 0xff) * size, &data[i * size], size);
+		}
+		free(data);
+		k = 0;
+	}
+}
+
+/* draw characters of one font into the image, from its atlas */
+static void
+xt_image_glyphs(struct xtmux *x, u_int type, u_int px, u_int py, const XChar2b *c2, size_t n,
+		unsigned long fg, unsigned long bg)
+{
+	struct font *font = x->font[type];
+	u_int gw = font->width, gh = font->ascent + font->descent;
+	size_t size = (size_t)gw * gh;
+	const u_char *g;
+	uint32_t *p;
+	u_int gx, gy, w, h;
+	size_t j;
+
+	xt_shm_load_glyphs(x, type, c2, n);
+	for (j = 0; j < n; j ++, px += gw)
+	{
+		w = gw;
+		h = gh;
+		if (!xt_image_clip(x, px, py, &w, &h))
+			break;
+		g = font->atlas[c2[j].byte1] + c2[j].byte2 * size;
+		for (gy = 0; gy < h; gy ++, g += gw)
+			for (p = xt_image_row(x, px, py + gy), gx = 0; gx < w; gx ++)
+				p[gx] = g[gx] ? fg : bg;
+	}
+}
+
+/* the cursor, which is xored like the core drawing does */
+static void
+xt_image_cursor(struct xtmux *x, u_int px, u_int py)
+{
+	uint32_t *p;
+	u_int gx, gy, w = x->cw, h = x->ch;
+
+	if (!x->cursor_image)
+		x->cursor_image = XGetImage(x->display, x->cursor, 0, 0, x->cw, x->ch, 1, ZPixmap);
+	if (!x->cursor_image || !xt_image_clip(x, px, py, &w, &h))
+		return;
+	for (gy = 0; gy < h; gy ++)
+		for (p = xt_image_row(x, px, py + gy), gx = 0; gx < w; gx ++)
+			if (XGetPixel(x->cursor_image, gx, gy))
+				p[gx] ^= x->cursor_pixel;
+}
+
+/* draw into shared memory according to xtmux-renderer, if the server allows */
+static void
+xt_shm_setup(struct tty *tty)
+{
+	struct xtmux *x = tty->xtmux;
+	int shm = options_get_number(tty->client->options, "xtmux-renderer") == XTMUX_RENDERER_SHM;
+	Window root;
+	int xpos, ypos;
+	u_int width, height, border, depth;
+
+	if (shm == (x->image != NULL))
+		return;
+
+	/* the cursor will be drawn again in the new target */
+	x->cd = 0;
+
+	if (shm)
+	{
+		if (!XShmQueryExtension(x->display))
+		{
+			log_debug("MIT-SHM not available; drawing on the server");
+			return;
+		}
+		XGetGeometry(x->display, x->window, &root, &xpos, &ypos, &width, &height, &border, &depth);
+		if (!xt_shm_resize(x, width, height))
+		{
+			log_debug("could not share memory with the X server; drawing on the server");
+			return;
+		}
+		xt_dirty(x, 0, 0, x->sx, x->sy);
+		xt_flush_timer(x);
+	}
+	else
+	{
+		xt_shm_free(x);
+		/* let the exposure redraw everything */
+		XClearArea(x->display, x->window, 0, 0, 0, 0, True);
+	}
+}
+#endif
+
+/* whether drawing goes somewhere the server cannot expose */
+static inline int
+xt_buffered(const struct xtmux *x)
+{
+#ifdef HAVE_XSHM
+	if (x->image)
+		return 1;
+#endif
+	return x->buffer != None;
+}
+
+/* fill a pixel rectangle with a solid color */
+static void
+xt_fill(struct xtmux *x, unsigned long pixel, u_int px, u_int py, u_int w, u_int h)
+{
+#ifdef HAVE_XSHM
+	if (x->image)
+	{
+		xt_image_fill(x, pixel, px, py, w, h);
+		return;
+	}
+#endif
+#ifdef HAVE_XRENDER
+	if (x->picture != None)
+	{
+		XRenderColor rc;
+
+		xt_render_color(x, pixel, &rc);
+		XRenderFillRectangle(x->display, PictOpSrc, x->picture, &rc, px, py, w, h);
+		return;
+	}
+#endif
+	XSetForeground(x->display, x->gc, pixel);
+	XFillRectangle(x->display, x->draw, x->gc, px, py, w, h);
+}
+
+/* note a pixel rectangle of the buffer that needs to be copied to the window */
+static void
+xt_damage(struct xtmux *x, u_int px, u_int py, u_int w, u_int h)
+{
+	XRectangle r;
+
+	if (!xt_buffered(x))
+		return;
+
+	r.x = px;
+	r.y = py;
+	r.width = w;
+	r.height = h;
+	XUnionRectWithRegion(&r, x->damage, x->damage);
+}
+
+/* clear a pixel rectangle to the background */
+static void
+xt_clear_area(struct xtmux *x, u_int px, u_int py, u_int w, u_int h)
+{
+	if (!xt_buffered(x))
+	{
+		XClearArea(x->display, x->window, px, py, w, h, False);
+		return;
+	}
+	xt_fill(x, x->bg, px, py, w, h);
+	xt_damage(x, px, py, w, h);
+}
+
+/* grow the buffer to cover at least the given size, keeping its contents */
+static void
+xt_buffer_resize(struct xtmux *x, u_int w, u_int h)
+{
+	Pixmap old = x->buffer;
+
+	if (old != None)
+	{
+		if (w <= x->buffer_w && h <= x->buffer_h)
+			return;
+		if (w < x->buffer_w)
+			w = x->buffer_w;
+		if (h < x->buffer_h)
+			h = x->buffer_h;
+	}
+
+	x->buffer = XCreatePixmap(x->display, x->window, w, h, x->depth);
+	XSetForeground(x->display, x->gc, x->bg);
+	XFillRectangle(x->display, x->buffer, x->gc, 0, 0, w, h);
+	if (old != None)
+	{
+		XSetGraphicsExposures(x->display, x->gc, False);
+		XCopyArea(x->display, old, x->buffer, x->gc, 0, 0, x->buffer_w, x->buffer_h, 0, 0);
+		XFreePixmap(x->display, old);
+	}
+	x->buffer_w = w;
+	x->buffer_h = h;
+	x->draw = x->buffer;
+#ifdef HAVE_XRENDER
+	xt_render_retarget(x);
+#endif
+}
+
+/* copy any damaged area of the buffer to the window */
+static int
+xt_buffer_flush(struct xtmux *x)
+{
+	XRectangle r;
+
+	if (!xt_buffered(x) || XEmptyRegion(x->damage))
+		return 0;
+
+	XSetRegion(x->display, x->buffer_gc, x->damage);
+	XClipBox(x->damage, &r);
+#ifdef HAVE_XSHM
+	/* the image may change before the server has read it, but anything
+	 * changed is damaged again and put in the next flush */
+	if (x->image)
+		XShmPutImage(x->display, x->window, x->buffer_gc, x->image,
+				r.x, r.y, r.x, r.y, r.width, r.height, False);
+	else
+#endif
+	XCopyArea(x->display, x->buffer, x->window, x->buffer_gc, r.x, r.y, r.width, r.height, r.x, r.y);
+	XDestroyRegion(x->damage);
+	x->damage = XCreateRegion();
+	return 1;
+}
+
+/* start or stop double buffering according to xtmux-double-buffer */
+static void
+xt_buffer_setup(struct tty *tty)
+{
+	struct xtmux *x = tty->xtmux;
+	int buffer = options_get_number(tty->client->options, "xtmux-double-buffer");
+
+#ifdef HAVE_XSHM
+	/* the image is already a buffer */
+	if (x->image)
+		buffer = 0;
+#endif
+	if (buffer == (x->buffer != None))
+		return;
+
+	/* the cursor will be drawn again in the new target */
+	x->cd = 0;
+
+	if (buffer)
+	{
+		Window root;
+		int xpos, ypos;
+		u_int width, height, border, depth;
+
+		XGetGeometry(x->display, x->window, &root, &xpos, &ypos, &width, &height, &border, &depth);
+		xt_buffer_resize(x, width, height);
+		xt_dirty(x, 0, 0, x->sx, x->sy);
+		xt_flush_timer(x);
+	}
+	else
+	{
+		XFreePixmap(x->display, x->buffer);
+		x->buffer = None;
+		x->draw = x->window;
+#ifdef HAVE_XRENDER
+		xt_render_retarget(x);
+#endif
+		/* let the exposure redraw everything */
+		XClearArea(x->display, x->window, 0, 0, 0, 0, True);
+	}
+}
 
 static void
 xt_size_hints(struct xtmux *x, XSizeHints *sh)
@@ -615,7 +2084,12 @@ xtmux_setup(struct tty *tty)
 {
 	struct xtmux *x = tty->xtmux;
 	struct options *o = tty->client->options;
-	const char *font, *prefix;
+	const char *font, *prefix, *colors;
+	char *fonts, *next;
+	u_int fps, ft;
+	int recolor;
+	unsigned long fg, bg;
+	struct timeval tv;
 	KeySym pkey = NoSymbol;
 	XColor pfg, pbg;
 
@@ -631,7 +2105,7 @@ xtmux_setup(struct tty *tty)
 
 	font = options_get_string(o, "xtmux-font");
 	if (xt_load_font(x, 0, font) > 0 ||
-			(!x->font->fid && xt_load_font(x, 0, "fixed") > 0))
+			(!x->font[0] && xt_load_font(x, 0, "fixed") > 0))
 	{
 		if (x->window)
 		{
@@ -643,6 +2117,15 @@ xtmux_setup(struct tty *tty)
 			XGetGeometry(x->display, x->window, &root, &xpos, &ypos, &width, &height, &border, &depth);
 			tty_set_size(tty, width/x->cw, height/x->ch);
 			XClearWindow(x->display, x->window);
+			if (x->buffer != None)
+				xt_clear_area(x, 0, 0, x->buffer_w, x->buffer_h);
+#ifdef HAVE_XSHM
+			if (x->image)
+				xt_clear_area(x, 0, 0, x->image->width, x->image->height);
+#endif
+			x->cd = 0;
+			xt_cells_resize(x, tty->sx, tty->sy);
+			xt_dirty(x, 0, 0, x->sx, x->sy);
 			recalculate_sizes();
 
 			xt_size_hints(x, &size_hints);
@@ -655,30 +2138,56 @@ xtmux_setup(struct tty *tty)
 			x->cursor = None;
 		}
 		xt_fill_cursor(x, tty->cstyle);
+
+		/* styles and fallbacks have to be checked against the new size */
+		for (ft = FONT_TYPE_BOLD; ft < FONT_MAX; ft ++)
+			xt_free_font(x, ft);
 	}
-	else if (!x->font->fid)
+	else if (!x->font[0])
 		XRETURN(0);
 
-	if (*(font = options_get_string(o, "xtmux-bold-font")))
-		xt_load_font(x, FONT_TYPE_BOLD, font);
-	else
-		xt_load_font(x, FONT_TYPE_BOLD, font_name_set(x->font->name, 3, "bold"));
-
-	if (*(font = options_get_string(o, "xtmux-italic-font")))
-		xt_load_font(x, FONT_TYPE_ITALIC, font);
-	else if (xt_load_font(x, FONT_TYPE_ITALIC, font_name_set(x->font->name, 4, "o")) < 0)
-		xt_load_font(x, FONT_TYPE_ITALIC, font_name_set(x->font->name, 4, "i"));
-
-	if (*(font = options_get_string(o, "xtmux-bold-italic-font")))
-		xt_load_font(x, FONT_TYPE_BOLD_ITALIC, font);
-	else
-		xt_load_font(x, FONT_TYPE_BOLD_ITALIC, font_name_set(x->font[FONT_TYPE_ITALIC].name, 3, "bold"));
+	/* styles are loaded when first drawn, or soon after */
+	x->style_pending = 1 << FONT_TYPE_BOLD | 1 << FONT_TYPE_ITALIC | 1 << FONT_TYPE_BOLD_ITALIC;
+	if (!event_initialized(&x->style_timer))
+		evtimer_set(&x->style_timer, xtmux_style_callback, tty);
+	tv.tv_sec = 0;
+	tv.tv_usec = XTMUX_STYLE_DELAY * 1000;
+	evtimer_add(&x->style_timer, &tv);
+
+	ft = FONT_TYPE_COUNT;
+	next = fonts = xstrdup(options_get_string(o, "xtmux-fallback-fonts"));
+	while (ft < FONT_MAX && (font = strsep(&next, ",")) != NULL)
+		if (*font && xt_load_font(x, ft, font) >= 0)
+			ft ++;
+	free(fonts);
+	for (; ft < FONT_MAX; ft ++)
+		xt_free_font(x, ft);
 
-	xt_fill_colors(x, options_get_string(o, "xtmux-colors"));
+	colors = options_get_string(o, "xtmux-colors");
+	recolor = !x->palette || strcmp(x->palette->spec, colors);
+	fg = x->fg;
+	bg = x->bg;
+	xt_fill_colors(x, colors);
 	x->bg = xt_parse_color(x, options_get_string(o, "xtmux-bg"), BlackPixel(x->display, XSCREEN));
 	x->fg = xt_parse_color(x, options_get_string(o, "xtmux-fg"), WhitePixel(x->display, XSCREEN));
+	/* cells look different with the same contents */
+	if (recolor || x->fg != fg || x->bg != bg)
+		xt_dirty(x, 0, 0, x->sx, x->sy);
 	if (x->window)
+	{
 		XSetWindowBackground(x->display, x->window, x->bg);
+#ifdef HAVE_XSHM
+		xt_shm_setup(tty);
+#endif
+		xt_buffer_setup(tty);
+#ifdef HAVE_XRENDER
+		xt_render_setup(tty);
+#endif
+	}
+
+	timerclear(&x->frame);
+	if ((fps = options_get_number(o, "xtmux-max-fps")))
+		x->frame.tv_usec = 1000000 / fps;
 
 	prefix = options_get_string(o, "xtmux-prefix");
 	x->prefix_mod = -1;
@@ -729,16 +2238,6 @@ xtmux_open(struct tty *tty, char **cause)
 	XWMHints wm_hints;
 	XClassHint class_hints;
 	XSizeHints size_hints;
-	XGCValues gc_values;
-	XVisualInfo visual_mask = {
-		.depth = 24,
-		.class = TrueColor,
-		.red_mask   = 0xff0000,
-		.green_mask = 0x00ff00,
-		.blue_mask  = 0x0000ff
-	};
-	XVisualInfo *visual;
-	int n;
 	XSetWindowAttributes attr;
 
 	XSetErrorHandler(xdisplay_error);
@@ -754,42 +2253,37 @@ xtmux_open(struct tty *tty, char **cause)
 		XRETURN(-1); \
 	})
 
-	x->display = XOpenDisplay(x->display_name);
-	if (!x->display)
+	x->xd = xdisplay_open(x->display_name);
+	if (!x->xd)
 		FAIL("could not open X display: %s", x->display_name);
-
-	event_set(&x->event, ConnectionNumber(x->display), EV_READ|EV_PERSIST, xdisplay_callback, tty);
-	if (event_add(&x->event, NULL) < 0)
-		fatal("failed to add X display event");
-
-	if (!XAddConnectionWatch(x->display, &xdisplay_connection_watch, (XPointer)tty))
-		FAIL("could not get X display connection: %s", x->display_name);
+	x->display = x->xd->display;
+	x->visual = x->xd->visual;
+	x->depth = x->xd->depth;
+	x->gc = x->xd->gc;
+	x->cursor_gc = x->xd->cursor_gc;
+	x->buffer_gc = x->xd->buffer_gc;
+	x->cursor_pixel = WhitePixel(x->display, XSCREEN);
 
 	if (xtmux_setup(tty))
 		FAIL("failed to setup X display");
 
-	if (!x->font->fid)
+	if (!x->font[0])
 		FAIL("could not load X font");
 
 	if (!tty->sx)
 		tty->sx = 80;
 	if (!tty->sy)
-		tty->sx = 24;
-
-	visual_mask.screen = XSCREEN;
-	visual = XGetVisualInfo(x->display, VisualScreenMask | VisualDepthMask | VisualClassMask | VisualRedMaskMask | VisualGreenMaskMask | VisualBlueMaskMask, &visual_mask, &n);
+		tty->sy = 24;
+	xt_cells_resize(x, tty->sx, tty->sy);
 
 	attr.background_pixel = x->bg;
 	x->window = XCreateWindow(x->display, DefaultRootWindow(x->display),
 			0, 0, C2W(tty->sx), C2H(tty->sy),
-			0, visual ? visual->depth : CopyFromParent, InputOutput,
-			visual ? visual->visual : CopyFromParent,
-			CWBackPixel, &attr);
-	if (visual)
-		XFree(visual);
-	/* else should not use RGB... */
+			0, x->depth, InputOutput,
+			x->visual, CWBackPixel, &attr);
 	if (x->window == None)
 		FAIL("could not create X window");
+	x->draw = x->window;
 
 	environ_set(tty->client->environ, "WINDOWID", "%u", (unsigned)x->window);
 
@@ -816,25 +2310,24 @@ xtmux_open(struct tty *tty, char **cause)
 	xt_class_hints(tty, &class_hints);
 	Xutf8SetWMProperties(x->display, x->window, class_hints.res_name, class_hints.res_name, NULL, 0, &size_hints, &wm_hints, &class_hints);
 
-	gc_values.foreground = x->fg;
-	gc_values.background = x->bg;
-	gc_values.font = x->font->fid;
-	gc_values.graphics_exposures = True;
-	x->gc = XCreateGC(x->display, x->window, GCForeground | GCBackground | GCFont | GCGraphicsExposures, &gc_values);
+	x->damage = XCreateRegion();
+#ifdef HAVE_XSHM
+	xt_shm_setup(tty);
+#endif
+	xt_buffer_setup(tty);
 
-	gc_values.foreground = WhitePixel(x->display, XSCREEN);
-	gc_values.background = BlackPixel(x->display, XSCREEN);
-	gc_values.function = GXxor; /* this'll be fine for TrueColor, etc, but we might want to avoid PseudoColor for this */
-	gc_values.graphics_exposures = False;
-	x->cursor_gc = XCreateGC(x->display, x->window, GCFunction | GCForeground | GCBackground | GCGraphicsExposures, &gc_values);
+#ifdef HAVE_XRENDER
+	xt_render_setup(tty);
+#endif
 	
 	XDefineCursor(x->display, x->window, x->pointer);
 
-	XSelectInput(x->display, x->window, KeyPressMask | ExposureMask | FocusChangeMask | StructureNotifyMask | ButtonPressMask | ButtonReleaseMask | ButtonMotionMask);
+	XSelectInput(x->display, x->window, KeyPressMask | ExposureMask | FocusChangeMask | StructureNotifyMask | ButtonPressMask | ButtonReleaseMask | ButtonMotionMask | PropertyChangeMask | VisibilityChangeMask);
 
 	XMapWindow(x->display, x->window);
 
 	evtimer_set(&x->flush_timer, xtmux_flush_callback, tty);
+	evtimer_set(&x->blink_timer, xtmux_blink_callback, tty);
 
 	tty->flags |= TTY_OPENED | TTY_UTF8;
 
@@ -847,14 +2340,16 @@ void
 xtmux_close(struct tty *tty)
 {
 	struct xtmux *x = tty->xtmux;
-	enum font_type ft;
+	u_int ft;
 
 	if (tty->flags & TTY_OPENED) {
 		tty->flags &= ~TTY_OPENED;
 
 		event_del(&x->flush_timer);
-		event_del(&x->event);
+		event_del(&x->blink_timer);
 	}
+	if (event_initialized(&x->style_timer))
+		event_del(&x->style_timer);
 
 	/* Must be careful here if we got an IO error:
 	 * want to free resources without using the connection */
@@ -886,40 +2381,49 @@ xtmux_close(struct tty *tty)
 
 	if (x->cursor != None)
 	{
-		XFreePixmap(x->display, x->cursor);
+		if (!x->ioerror)
+			XFreePixmap(x->display, x->cursor);
 		x->cursor = None;
 	}
 
-	if (x->cursor_gc != None)
+	/* shared with the display */
+	x->gc = x->cursor_gc = x->buffer_gc = None;
+
+#ifdef HAVE_XRENDER
+	xt_render_free(x);
+#endif
+#ifdef HAVE_XSHM
+	xt_shm_free(x);
+#endif
+
+	if (x->buffer != None)
 	{
-		XFreeGC(x->display, x->cursor_gc);
-		x->cursor_gc = None;
+		if (!x->ioerror)
+			XFreePixmap(x->display, x->buffer);
+		x->buffer = None;
 	}
 
-	if (x->gc != None)
+	if (x->damage != NULL)
 	{
-		XFreeGC(x->display, x->gc);
-		x->gc = None;
+		XDestroyRegion(x->damage);
+		x->damage = NULL;
 	}
 
 	if (x->window != None)
 	{
 		if (!x->ioerror)
-			XFreeColors(x->display, XCOLORMAP, x->colors, XTMUX_NUM_COLORS, 0);
-		XDestroyWindow(x->display, x->window);
+			XDestroyWindow(x->display, x->window);
 		x->window = None;
 	}
 
-	for (ft = 0; ft < FONT_TYPE_COUNT; ft ++)
-		xt_free_font(x, ft);
-
-	if (x->display != NULL)
+	if (x->xd)
 	{
-		int fd = ConnectionNumber(x->display);
-		XCloseDisplay(x->display);
+		xt_free_colors(x);
+		for (ft = 0; ft < FONT_MAX; ft ++)
+			xt_free_font(x, ft);
+		xdisplay_close(x->xd);
+		x->xd = NULL;
 		x->display = NULL;
-		/* if ioerror, sometimes connection is left open; should be safe regardless */
-		close(fd);
 	}
 }
 
@@ -927,6 +2431,10 @@ void
 xtmux_free(struct tty *tty)
 {
 	xtmux_close(tty);
+	free(tty->xtmux->cells);
+	free(tty->xtmux->dirty);
+	free(tty->xtmux->fills);
+	free(tty->xtmux->fill_pixels);
 	free(tty->xtmux->display_name);
 	free(tty->xtmux);
 }
@@ -979,90 +2487,222 @@ xtmux_attributes(struct tty *tty, const struct grid_cell *gc)
 void
 xtmux_reset(struct tty *tty)
 {
-	xtmux_attributes(tty, &grid_default_cell);
+	xtmux_attributes(tty, &grid_default_cell);
+}
+
+static inline int
+xt_put_cursor(struct xtmux *x)
+{
+	if (!x->cd)
+		return 0;
+
+#ifdef HAVE_XSHM
+	if (x->image)
+		xt_image_cursor(x, C2X(x->cx), C2Y(x->cy));
+	else
+#endif
+	{
+		XSetForeground(x->display, x->cursor_gc, x->cursor_pixel);
+		XCopyPlane(x->display, x->cursor, x->draw, x->cursor_gc, 0, 0, x->cw, x->ch, C2X(x->cx), C2Y(x->cy), 1);
+	}
+	xt_damage(x, C2X(x->cx), C2Y(x->cy), C2W(1), C2H(1));
+	return 1;
+}
+
+static int
+xt_clear_cursor(struct xtmux *x)
+{
+	int r = xt_put_cursor(x);
+	x->cd = 0;
+	return r;
+}
+
+static void
+xt_flush_timer(struct xtmux *x)
+{
+	if (x->flush)
+		XUPDATE();
+	else if (!evtimer_pending(&x->flush_timer, NULL)) {
+		struct timeval now, tv;
+
+		/* draw as soon as a frame has passed since the last one */
+		gettimeofday(&now, NULL);
+		timeradd(&x->last_frame, &x->frame, &tv);
+		if (timercmp(&tv, &now, >))
+			timersub(&tv, &now, &tv);
+		else
+			timerclear(&tv);
+		evtimer_add(&x->flush_timer, &tv);
+	}
+}
+
+static inline struct cell *
+xt_cell(struct xtmux *x, u_int cx, u_int cy)
+{
+	return &x->cells[cy * x->sx + cx];
+}
+
+static inline int
+xt_cell_attr_cmp(const struct cell *a, const struct cell *b)
+{
+	return !(a->attr == b->attr &&
+			a->flags == b->flags &&
+			a->fg == b->fg &&
+			a->bg == b->bg);
 }
 
+/* returns 0 if the cell already had this in it, so need not be drawn */
 static inline int
-xt_put_cursor(struct xtmux *x)
+xt_set_cell(struct cell *cl, wchar c, const struct grid_cell *gc)
 {
-	if (!x->cd)
+	struct cell n;
+
+	n.c = gc->flags & GRID_FLAG_PADDING ? WCHAR_PADDING : c;
+	n.flags = gc->flags & ~GRID_FLAG_PADDING;
+	n.attr = gc->attr;
+	n.fg = gc->fg;
+	n.bg = gc->bg;
+	if (n.c == cl->c && !xt_cell_attr_cmp(&n, cl))
 		return 0;
-
-	XCopyPlane(x->display, x->cursor, x->window, x->cursor_gc, 0, 0, x->cw, x->ch, C2X(x->cx), C2Y(x->cy), 1);
+	*cl = n;
 	return 1;
 }
 
-static int
-xt_clear_cursor(struct xtmux *x)
+/* mark cells as needing to be drawn, clipped to the screen */
+static void
+xt_dirty(struct xtmux *x, u_int cx, u_int cy, u_int w, u_int h)
 {
-	int r = xt_put_cursor(x);
-	x->cd = 0;
-	return r;
+	struct span *d;
+
+	if (cx >= x->sx || cy >= x->sy)
+		return;
+	if (w > x->sx - cx)
+		w = x->sx - cx;
+	if (h > x->sy - cy)
+		h = x->sy - cy;
+	if (!w)
+		return;
+
+	for (d = &x->dirty[cy]; h --; d ++)
+	{
+		if (d->x1 >= d->x2)
+		{
+			d->x1 = cx;
+			d->x2 = cx+w;
+			continue;
+		}
+		if (cx < d->x1)
+			d->x1 = cx;
+		if (cx+w > d->x2)
+			d->x2 = cx+w;
+	}
 }
 
+/* reallocate cells for a new screen size; everything must be drawn again */
 static void
-xt_flush_timer(struct xtmux *x)
+xt_cells_resize(struct xtmux *x, u_int sx, u_int sy)
 {
-	if (x->flush)
-		XUPDATE();
-	else if (!evtimer_pending(&x->flush_timer, NULL)) {
-		struct timeval tv = { .tv_usec = 100000 };
-		evtimer_add(&x->flush_timer, &tv);
-	}
+	u_int i;
+
+	/* callers draw everything again, so any pending scroll is moot */
+	x->scroll.n = 0;
+	if (!sx)
+		sx = 1;
+	if (!sy)
+		sy = 1;
+	if (x->cells && sx == x->sx && sy == x->sy)
+		return;
+
+	x->cells = xreallocarray(x->cells, sx * sy, sizeof *x->cells);
+	x->dirty = xreallocarray(x->dirty, sy, sizeof *x->dirty);
+	x->sx = sx;
+	x->sy = sy;
+	memset(x->cells, 0, sx * sy * sizeof *x->cells);
+	for (i = 0; i < sx * sy; i ++)
+		xt_set_cell(&x->cells[i], ' ', &grid_default_cell);
+	memset(x->dirty, 0, sy * sizeof *x->dirty);
+	xt_dirty(x, 0, 0, sx, sy);
 }
 
-static inline void
-xt_flush(struct xtmux *x, u_int px, u_int py, u_int w, u_int h)
+static void
+xt_put(struct xtmux *x, u_int cx, u_int cy, wchar c, const struct grid_cell *gc)
 {
-	struct putc *b = &x->putc_buf;
-
-	if (b->n && INSIDE1(b->y, py, h) && OVERLAPS1(b->x, b->n, px, w))
-		xt_putc_flush(x);
-	if (x->cd && INSIDE(x->cx, x->cy, px, py, w, h))
-		xt_clear_cursor(x);
+	if (cx >= x->sx || cy >= x->sy)
+		return;
+	if (xt_set_cell(xt_cell(x, cx, cy), c, gc))
+		xt_dirty(x, cx, cy, 1, 1);
 }
 
-/* indicate an intention to completely overwrite a region; return 1 if contains the cursor */
-static int
-xt_write(struct xtmux *x, u_int px, u_int py, u_int w, u_int h, int c)
+static void
+xt_clear(struct xtmux *x, u_int cx, u_int cy, u_int w, u_int h)
 {
-	struct putc *b = &x->putc_buf;
-	int r = 0;
+	u_int y, i;
 
-	if (b->n && WITHIN(b->x, b->y, b->n, 1, px, py, w, h))
-		b->n = 0;
-	/* the cursor is special, as it may be drawn/erased before exposure events */
-	if (INSIDE(x->cx, x->cy, px, py, w, h)) {
-		if (c)
-			XClearArea(x->display, x->window, C2X(x->cx), C2Y(x->cy), C2W(1), C2H(1), False);
-		x->cd = 0;
-		r = 1;
-	}
+	if (cx >= x->sx || cy >= x->sy)
+		return;
+	if (w > x->sx - cx)
+		w = x->sx - cx;
+	if (h > x->sy - cy)
+		h = x->sy - cy;
 
-	xt_flush(x, px, py, w, h);
-	return r;
+	for (y = cy; y < cy+h; y ++)
+	{
+		struct cell *cl = xt_cell(x, cx, y);
+		u_int x1 = w, x2 = 0;
+
+		for (i = 0; i < w; i ++)
+			if (xt_set_cell(&cl[i], ' ', &grid_default_cell))
+			{
+				if (i < x1)
+					x1 = i;
+				x2 = i+1;
+			}
+		if (x1 < x2)
+			xt_dirty(x, cx+x1, y, x2-x1, 1);
+	}
 }
 
 static int
-xt_clear(struct xtmux *x, u_int cx, u_int cy, u_int w, u_int h)
+xt_cursor_blinks(struct tty *tty)
 {
-	xt_write(x, cx, cy, w, h, 0);
-	XClearArea(x->display, x->window, C2X(cx), C2Y(cy), C2W(w), C2H(h), False);
-	return 1;
+	struct xtmux *x = tty->xtmux;
+
+	if (x->focus_out || tty->flags & TTY_UNMAPPED)
+		return 0;
+	return (tty->cstyle & 1) || (tty->mode & MODE_BLINKING);
 }
 
+/* keep the blink going, starting from shown again if restart */
 static void
-xt_redraw(struct xtmux *x, u_int cx, u_int cy, u_int w, u_int h)
+xt_blink(struct tty *tty, int restart)
 {
-	XClearArea(x->display, x->window, C2X(cx), C2Y(cy), C2W(w), C2H(h), False);
-	xtmux_redraw(x->client, cx, cy, cx+w, cy+h);
+	struct xtmux *x = tty->xtmux;
+	struct timeval tv;
+
+	if (!xt_cursor_blinks(tty))
+	{
+		x->blink_off = 0;
+		evtimer_del(&x->blink_timer);
+		return;
+	}
+	if (restart)
+	{
+		x->blink_off = 0;
+		evtimer_del(&x->blink_timer);
+	}
+	if (!evtimer_pending(&x->blink_timer, NULL))
+	{
+		tv.tv_sec = 0;
+		tv.tv_usec = XTMUX_BLINK_TIME * 1000;
+		evtimer_add(&x->blink_timer, &tv);
+	}
 }
 
 static int
 xt_update_cursor(struct tty *tty)
 {
 	struct xtmux *x = tty->xtmux;
-	int r = 0;
+	int r = 0, moved;
 
 	if (!(tty->mode & MODE_CURSOR)) {
 		if (x->cd)
@@ -1070,7 +2710,18 @@ xt_update_cursor(struct tty *tty)
 		return r;
 	}
 
-	if (x->cd && x->cx == tty->cx && x->cy == tty->cy)
+	moved = x->cx != tty->cx || x->cy != tty->cy;
+	xt_blink(tty, moved);
+	if (x->blink_off)
+	{
+		if (x->cd)
+			r = xt_clear_cursor(x);
+		x->cx = tty->cx;
+		x->cy = tty->cy;
+		return r;
+	}
+
+	if (x->cd && !moved)
 		return r;
 
 	xt_clear_cursor(x);
@@ -1082,27 +2733,49 @@ xt_update_cursor(struct tty *tty)
 	return 1;
 }
 
+static inline struct copy *
+xt_copy_queued(struct xtmux *x, u_int i)
+{
+	return &x->copies[(x->copy_first + i) % XTMUX_COPY_QUEUE];
+}
+
+/* forget copies the server has finished with as of serial */
 static void
+xt_copy_done(struct xtmux *x, u_long serial, int done)
+{
+	while (x->copy_count)
+	{
+		struct copy *c = xt_copy_queued(x, 0);
+
+		if (SERIAL_AFTER(c->serial, serial) || (c->serial == serial && !done))
+			break;
+		x->copy_first = (x->copy_first + 1) % XTMUX_COPY_QUEUE;
+		x->copy_count --;
+	}
+}
+
+static int
 xt_do_copy(struct xtmux *x, u_int x1, u_int y1, u_int x2, u_int y2, u_int w, u_int h)
 {
-	while (x->copy_active)
-	{
-		XEvent xev;
-		XSync(x->display, False);
-		if (XCheckTypedWindowEvent(x->display, x->window, GraphicsExpose, &xev))
-			xt_expose(x, &xev.xexpose);
-		else if (XCheckTypedWindowEvent(x->display, x->window, NoExpose, &xev))
-			x->copy_active --;
-		else {
-			/* this should not happen;
-			 * however, if it does, we can't copy cleanly.
-			 * instead, just clear and refresh (poorly), and hope
-			 * the proper event comes in later if it matters
-			 */
-			fprintf(stderr, "didn't get expected expose event; redrawing\n");
-			xt_redraw(x, x2, y2, w, h);
-			return;
-		}
+	/* nothing can be exposed copying within the buffer */
+	if (!xt_buffered(x))
+	{
+		struct copy *c;
+
+		/* too far ahead of the server to keep track of what it
+		 * might expose; the caller must draw instead */
+		if (x->copy_count == XTMUX_COPY_QUEUE)
+			return 0;
+
+		/* any exposures are repaired from xt_expose when they arrive */
+		c = xt_copy_queued(x, x->copy_count ++);
+		c->serial = NextRequest(x->display);
+		c->src.x = C2X(x1);
+		c->src.y = C2Y(y1);
+		c->src.width = C2W(w);
+		c->src.height = C2H(h);
+		c->dx = C2X(x2) - C2X(x1);
+		c->dy = C2Y(y2) - C2Y(y1);
 	}
 
 	if (x->cd)
@@ -1112,21 +2785,107 @@ xt_do_copy(struct xtmux *x, u_int x1, u_int y1, u_int x2, u_int y2, u_int w, u_i
 		else if (INSIDE(x->cx, x->cy, x2, y2, w, h))
 			x->cd = 0;
 	}
-	x->copy_active ++;
-	XCopyArea(x->display, x->window, x->window, x->gc,
-			C2X(x1), C2Y(y1), C2W(w), C2H(h), C2X(x2), C2Y(y2));
+#ifdef HAVE_XSHM
+	if (x->image)
+		xt_image_copy(x, C2X(x1), C2Y(y1), C2X(x2), C2Y(y2), C2W(w), C2H(h));
+	else
+#endif
+	{
+		/* copies never expose anything within the buffer */
+		XSetGraphicsExposures(x->display, x->gc, x->buffer == None);
+		XCopyArea(x->display, x->draw, x->draw, x->gc,
+				C2X(x1), C2Y(y1), C2W(w), C2H(h), C2X(x2), C2Y(y2));
+	}
+	xt_damage(x, C2X(x2), C2Y(y2), C2W(w), C2H(h));
+	return 1;
+}
+
+/* get the copy for the pending scroll, if there is anything to copy */
+static int
+xt_scroll_copy(struct xtmux *x, u_int *y1, u_int *y2, u_int *h)
+{
+	struct scroll *s = &x->scroll;
+	u_int n = s->n < 0 ? -s->n : s->n;
+
+	if (!s->n || n >= s->h)
+		return 0;
+	*y1 = s->n < 0 ? s->y + n : s->y;
+	*y2 = s->n < 0 ? s->y : s->y + n;
+	*h = s->h - n;
+	return 1;
+}
+
+/* do the copy for the scrolls so far; the cells have already been moved */
+static void
+xt_scroll_flush(struct xtmux *x)
+{
+	struct scroll *s = &x->scroll;
+	u_int y1, y2, h;
+
+	if (!s->n)
+		return;
+	if (!xt_scroll_copy(x, &y1, &y2, &h))
+		/* scrolled right out; xt_scroll cleared it all */
+		xt_dirty(x, s->x, s->y, s->w, s->h);
+	else if (!xt_do_copy(x, s->x, y1, s->x, y2, s->w, h))
+		xt_dirty(x, s->x, y2, s->w, h);
+	s->n = 0;
+}
+
+/* move cells [sx, sx+w) of row from to row to, along with whether they need drawing */
+static void
+xt_move_row(struct xtmux *x, u_int from, u_int to, u_int sx, u_int w)
+{
+	struct span *s = &x->dirty[from], *d = &x->dirty[to];
+	u_int x1 = s->x1 > sx ? s->x1 : sx;
+	u_int x2 = s->x2 < sx+w ? s->x2 : sx+w;
+
+	memcpy(xt_cell(x, sx, to), xt_cell(x, sx, from), w * sizeof *x->cells);
+
+	if (d->x1 >= d->x2 || (d->x1 >= sx && d->x2 <= sx+w))
+	{
+		/* nothing outside the region is dirty */
+		d->x1 = x1 < x2 ? x1 : 0;
+		d->x2 = x1 < x2 ? x2 : 0;
+	}
+	else if (x1 < x2)
+	{
+		if (x1 < d->x1)
+			d->x1 = x1;
+		if (x2 > d->x2)
+			d->x2 = x2;
+	}
 }
 
 static void
 xt_scroll(struct xtmux *x, u_int sx, u_int sy, u_int w, u_int h, int n)
 {
-	xt_flush(x, sx, sy, w, h);
+	struct scroll *s = &x->scroll;
+	u_int y;
+
+	if (sx >= x->sx || sy >= x->sy || !n)
+		return;
+	if (w > x->sx - sx)
+		w = x->sx - sx;
+	if (h > x->sy - sy)
+		h = x->sy - sy;
+
+	/* consecutive scrolls of the same region become one copy when
+	 * drawing; anything else must be copied first */
+	if (s->n && (s->x != sx || s->y != sy || s->w != w || s->h != h))
+		xt_scroll_flush(x);
+	s->x = sx;
+	s->y = sy;
+	s->w = w;
+	s->h = h;
+	s->n += n;
 
 	if (n < 0)
 	{	/* up */
 		n = -n;
 		if (h > (u_int)n) {
-			xt_do_copy(x, sx, sy+n, sx, sy, w, h-n);
+			for (y = sy; y < sy+h-n; y ++)
+				xt_move_row(x, y+n, y, sx, w);
 			sy += h-n;
 			h = n;
 		}
@@ -1134,20 +2893,38 @@ xt_scroll(struct xtmux *x, u_int sx, u_int sy, u_int w, u_int h, int n)
 	else
 	{ 	/* down */
 		if (h > (u_int)n) {
-			xt_do_copy(x, sx, sy, sx, sy+n, w, h-n);
+			for (y = sy+h-n; y -- > sy; )
+				xt_move_row(x, y, y+n, sx, w);
 			h = n;
 		}
 	}
 	xt_clear(x, sx, sy, w, h);
 }
 
+/* horizontal copy within rows */
 static void
 xt_copy(struct xtmux *x, u_int x1, u_int y1, u_int x2, u_int y2, u_int w, u_int h)
 {
-	xt_flush(x, x1, y1, w, h);
-	return xt_do_copy(x, x1, y1, x2, y2, w, h);
-}
+	u_int y;
+
+	if (!w || y1 != y2 || (x1 > x2 ? x1 : x2) + w > x->sx || y1 + h > x->sy)
+		return;
+
+	xt_scroll_flush(x);
+	if (!xt_do_copy(x, x1, y1, x2, y2, w, h))
+		/* moves to the destination below */
+		xt_dirty(x, x1, y1, w, h);
+	for (y = y1; y < y1+h; y ++)
+	{
+		struct span *d = &x->dirty[y];
+		u_int dx1 = d->x1 > x1 ? d->x1 : x1;
+		u_int dx2 = d->x2 < x1+w ? d->x2 : x1+w;
 
+		memmove(xt_cell(x, x2, y), xt_cell(x, x1, y), w * sizeof *x->cells);
+		if (dx1 < dx2)
+			xt_dirty(x, dx1 + x2 - x1, y, dx2 - dx1, 1);
+	}
+}
 void
 xtmux_cursor(struct tty *tty, u_int cx, u_int cy)
 {
@@ -1168,7 +2945,7 @@ xtmux_force_cursor_colour(struct tty *tty, const char *ccolour)
 	c = xt_parse_color(x, ccolour, x->bg ^ c);
 	log_debug("setting cursor color to %s = %lx", ccolour, c);
 	xt_clear_cursor(x);
-	XSetForeground(x->display, x->cursor_gc, x->bg ^ c);
+	x->cursor_pixel = x->bg ^ c;
 	XRETURN_();
 	xt_flush_timer(x);
 }
@@ -1193,34 +2970,227 @@ xtmux_update_mode(struct tty *tty, int mode, struct screen *s)
 	xt_flush_timer(x);
 }
 
-static enum font_type
-xt_font_pick(const struct xtmux *x, enum font_type type, wchar c)
+/* the first fonts for a style that have a character, for narrow and wide cells */
+static u_char
+xt_font_find(const struct xtmux *x, enum font_type type, wchar c)
 {
-	if (c == ' ')
-		return FONT_TYPE_NONE;
-	if (!type || xt_font_has_char(x, type, c))
-		return type;
+	u_char chain[FONT_MAX];
+	u_int n = 0, i, narrow = FONT_NONE, wide = FONT_NONE;
+
+	chain[n++] = type;
 	if (type == FONT_TYPE_BOLD_ITALIC)
 	{
-		if (xt_font_has_char(x, FONT_TYPE_ITALIC, c))
-			return FONT_TYPE_ITALIC;
-		if (xt_font_has_char(x, FONT_TYPE_BOLD, c))
-			return FONT_TYPE_BOLD;
+		chain[n++] = FONT_TYPE_ITALIC;
+		chain[n++] = FONT_TYPE_BOLD;
+	}
+	if (type != FONT_TYPE_BASE)
+		chain[n++] = FONT_TYPE_BASE;
+	for (i = FONT_TYPE_COUNT; i < FONT_MAX; i ++)
+		chain[n++] = i;
+
+	for (i = 0; i < n && narrow == FONT_NONE; i ++)
+	{
+		if (!xt_font_has_char(x, chain[i], c))
+			continue;
+		if (wide == FONT_NONE)
+			wide = chain[i];
+		if (!xt_font_wide(x, chain[i]))
+			narrow = chain[i];
 	}
-	if (xt_font_has_char(x, FONT_TYPE_BASE, c))
-		return FONT_TYPE_BASE;
-	return FONT_TYPE_NONE;
+	return narrow | wide << 4;
 }
 
-static int
+static u_char *
+xt_font_map_fill(struct xtmux *x, enum font_type type, u_int hi)
+{
+	u_char *block = x->font_map[type][hi] = xmalloc(256);
+	u_int i;
+
+	for (i = 0; i < 256; i ++)
+		block[i] = xt_font_find(x, type, hi << 8 | i);
+	return block;
+}
+
+/* cached xt_font_find; core fonts have nothing outside the BMP */
+static inline u_char
+xt_font_lookup(struct xtmux *x, enum font_type type, wchar c)
+{
+	const u_char *block;
+
+	if (c > 0xFFFF)
+		return FONT_NONE | FONT_NONE << 4;
+	if (!(block = x->font_map[type][c >> 8]))
+		block = xt_font_map_fill(x, type, c >> 8);
+	return block[c & 0xFF];
+}
+
+/* pick the font to draw a character with, or FONT_NONE for any font,
+ * substituting a replacement if none of them have it */
+static u_char
+xt_font_char(struct xtmux *x, enum font_type type, int charset, wchar *cp, int wide)
+{
+	wchar c = *cp;
+	u_char f;
+
+	if (charset)
+	{
+		if (c >= '`' && c <= '~' && FONT_NARROW(xt_font_lookup(x, type, c-('`'-1))) != FONT_NONE)
+			c -= '`'-1;
+		else if (c < nitems(xtmux_acs) && xtmux_acs[c])
+			c = xtmux_acs[c];
+	}
+	if (c == ' ')
+		return FONT_NONE;
+
+	f = xt_font_lookup(x, type, c);
+	f = wide ? FONT_WIDE(f) : FONT_NARROW(f);
+	if (f == FONT_NONE)
+	{
+		c = WCHAR_REPLACEMENT;
+		if ((f = FONT_NARROW(xt_font_lookup(x, type, c))) == FONT_NONE)
+		{
+			c = '?';
+			f = FONT_NARROW(xt_font_lookup(x, type, c));
+		}
+	}
+	*cp = c;
+	return f;
+}
+
+/* xt_font_char for all narrow characters below 0x80 */
+static const struct glyph_map *
+xt_low_map(struct xtmux *x, enum font_type type, int charset)
+{
+	struct glyph_map **map = &x->low_map[type][!!charset];
+	wchar c, r;
+
+	if (!*map)
+	{
+		*map = xcalloc(0x80, sizeof **map);
+		for (c = 0; c < 0x80; c ++)
+		{
+			r = c;
+			(*map)[c].font = xt_font_char(x, type, charset, &r, 0);
+			(*map)[c].c = r;
+		}
+	}
+	return *map;
+}
+
+static unsigned long
 xt_get_color(struct xtmux *x, int c) {
-	return c & COLOUR_FLAG_RGB
-		? c & 0xffffff
-		: x->colors[c & 0xff];
+	struct xdisplay *xd = x->xd;
+	unsigned long pixel;
+
+	if (!(c & COLOUR_FLAG_RGB))
+		return x->colors[c & 0xff];
+	if (xd->rgb)
+		return xd->rgb[(c >> 16) & 0xff] |
+			xd->rgb[256 + ((c >> 8) & 0xff)] |
+			xd->rgb[512 + (c & 0xff)];
+	if (xdisplay_alloc_rgb(xd, c & 0xffffff, &pixel))
+		return pixel;
+	/* colormap or cache full; use the nearest of the 256 */
+	return x->colors[colour_find_rgb(c >> 16, c >> 8, c) & 0xff];
+}
+
+static void
+xt_fill_add(struct xtmux *x, unsigned long pixel, int px, int py, u_int w, u_int h)
+{
+	XRectangle *r;
+
+	if (x->nfills == x->fills_size)
+	{
+		x->fills_size = x->fills_size ? 2 * x->fills_size : 64;
+		x->fills = xreallocarray(x->fills, x->fills_size, sizeof *x->fills);
+		x->fill_pixels = xreallocarray(x->fill_pixels, x->fills_size, sizeof *x->fill_pixels);
+	}
+	x->fill_pixels[x->nfills] = pixel;
+	r = &x->fills[x->nfills ++];
+	r->x = px;
+	r->y = py;
+	r->width = w;
+	r->height = h;
+}
+
+/* queue the lines of box drawing characters, if the cells are only those */
+static int
+xt_draw_lines(struct xtmux *x, u_int cx, u_int cy, const wchar *cp, size_t n, unsigned long fg)
+{
+	u_int i, px, py = C2Y(cy), mx, my;
+	u_int t = x->cw >= 16 ? x->cw / 8 : 1; /* thickness */
+	u_char a;
+
+	for (i = 0; i < n; i ++)
+		if (cp[i] != ' ' && (cp[i] >= nitems(xtmux_acs_lines) || !xtmux_acs_lines[cp[i]]))
+			return 0;
+
+	my = py + (x->ch - t) / 2;
+	for (i = 0; i < n; i ++)
+	{
+		if (cp[i] == ' ')
+			continue;
+		a = xtmux_acs_lines[cp[i]];
+		px = C2X(cx + i);
+		mx = px + (x->cw - t) / 2;
+
+		if ((a & (LINE_UP | LINE_DOWN)) == (LINE_UP | LINE_DOWN))
+			xt_fill_add(x, fg, mx, py, t, x->ch);
+		else if (a & LINE_UP)
+			xt_fill_add(x, fg, mx, py, t, my + t - py);
+		else if (a & LINE_DOWN)
+			xt_fill_add(x, fg, mx, my, t, py + x->ch - my);
+
+		if ((a & (LINE_LEFT | LINE_RIGHT)) == (LINE_LEFT | LINE_RIGHT))
+			xt_fill_add(x, fg, px, my, x->cw, t);
+		else if (a & LINE_LEFT)
+			xt_fill_add(x, fg, px, my, mx + t - px, t);
+		else if (a & LINE_RIGHT)
+			xt_fill_add(x, fg, mx, my, px + x->cw - mx, t);
+	}
+	return 1;
+}
+
+/* do the queued fills, with one request for each colour */
+static void
+xt_fills_flush(struct xtmux *x)
+{
+	XRectangle r;
+	unsigned long pixel;
+	u_int i, n, start = 0;
+
+	while (start < x->nfills)
+	{
+		/* move this colour's rectangles together */
+		pixel = x->fill_pixels[start];
+		for (i = n = start; i < x->nfills; i ++)
+			if (x->fill_pixels[i] == pixel)
+			{
+				x->fill_pixels[i] = x->fill_pixels[n];
+				x->fill_pixels[n] = pixel;
+				r = x->fills[i];
+				x->fills[i] = x->fills[n];
+				x->fills[n ++] = r;
+			}
+
+#ifdef HAVE_XSHM
+		if (x->image)
+			for (i = start; i < n; i ++)
+				xt_image_fill(x, pixel, x->fills[i].x, x->fills[i].y,
+						x->fills[i].width, x->fills[i].height);
+		else
+#endif
+		{
+			XSetForeground(x->display, x->gc, pixel);
+			XFillRectangles(x->display, x->draw, x->gc, &x->fills[start], n - start);
+		}
+		start = n;
+	}
+	x->nfills = 0;
 }
 
 static void
-xt_draw_chars(struct xtmux *x, u_int cx, u_int cy, const wchar *cp, size_t n, const struct grid_cell *gc, int cleared)
+xt_draw_chars(struct xtmux *x, u_int cx, u_int cy, const wchar *cp, size_t n, const struct grid_cell *gc)
 {
 	u_int			i, px = C2X(cx), py = C2Y(cy), wx = C2W(n), hy = C2H(1);
 	int			fgc = gc->fg, bgc = gc->bg;
@@ -1230,8 +3200,10 @@ xt_draw_chars(struct xtmux *x, u_int cx, u_int cy, const wchar *cp, size_t n, co
 	if (gc->flags & GRID_FLAG_PADDING)
 		return;
 
-	if (xt_write(x, cx, cy, n, 1, 0))
-		cleared = 0;
+	/* the cursor is about to be overwritten */
+	if (x->cd && INSIDE(x->cx, x->cy, cx, cy, n, 1))
+		x->cd = 0;
+	xt_damage(x, px, py, wx, hy);
 
 	/* TODO: palette */
 
@@ -1257,11 +3229,11 @@ xt_draw_chars(struct xtmux *x, u_int cx, u_int cy, const wchar *cp, size_t n, co
 	}
 
 	if (gc->attr & GRID_ATTR_ITALICS && gc->attr & GRID_ATTR_BRIGHT &&
-			x->font[ft = FONT_TYPE_BOLD_ITALIC].fid);
+			xt_style_font(x, ft = FONT_TYPE_BOLD_ITALIC));
 	else if (gc->attr & GRID_ATTR_ITALICS &&
-			x->font[ft = FONT_TYPE_ITALIC].fid);
+			xt_style_font(x, ft = FONT_TYPE_ITALIC));
 	else if (gc->attr & GRID_ATTR_BRIGHT &&
-			x->font[ft = FONT_TYPE_BOLD].fid);
+			xt_style_font(x, ft = FONT_TYPE_BOLD));
 	else ft = 0;
 
 	/* TODO: configurable BRIGHT semantics */
@@ -1274,119 +3246,195 @@ xt_draw_chars(struct xtmux *x, u_int cx, u_int cy, const wchar *cp, size_t n, co
 		if (cp[i] != ' ')
 			break;
 
-	if (i == n || gc->attr & GRID_ATTR_HIDDEN)
+	if (i == n && bg != x->bg && !(gc->attr & (GRID_ATTR_UNDERSCORE | GRID_ATTR_BLINK)))
+	{
+		/* runs of blanks, like display-panes numbers, are put together */
+		xt_fill_add(x, bg, px, py, wx, hy);
+	}
+	else if (i == n || gc->attr & GRID_ATTR_HIDDEN ||
+			(gc->attr & GRID_ATTR_CHARSET && xt_draw_lines(x, cx, cy, cp, n, fg)))
 	{
 		if (bg == x->bg)
-		{
-			if (!cleared)
-				XClearArea(x->display, x->window, px, py, wx, hy, False);
-		}
+			xt_clear_area(x, px, py, wx, hy);
 		else
-		{
-			XSetForeground(x->display, x->gc, bg);
-			XFillRectangle(x->display, x->window, x->gc, px, py, wx, hy);
-		}
+			xt_fill(x, bg, px, py, wx, hy);
 	}
 	else
 	{
 		XChar2b c2[n];
-		u_int l = 0;
-		enum font_type ftl = ft, ftc;
+		u_int k = 0, kl = 0, l = 0;
+		u_char ftl = ft, ftc;
+		int wide, covered = 0;
+		int charset = gc->attr & GRID_ATTR_CHARSET;
+		const struct glyph_map *low = xt_low_map(x, ft, charset);
+#ifdef HAVE_XRENDER
+		u_short cm[n];
+		XGlyphElt16 elts[n];
+		u_int ne = 0;
+#endif
 		
 		if (gc->attr & GRID_ATTR_ITALICS && !(ft & FONT_TYPE_ITALIC))
 			XCHG(fg, bg);
-		XSetForeground(x->display, x->gc, fg);
+#ifdef HAVE_XRENDER
+		if (x->picture == None)
+#endif
+			XSetForeground(x->display, x->gc, fg);
 
-		for (l = 0; l < n; l = i)
+		/* split into runs of one font; cell l is where run [kl, k) starts */
+		for (i = 0; i <= n; i ++)
 		{
-			for (i = l; i < n; i ++)
-			{
-				wchar c = cp[i];
+			wchar c = ' ';
 
-				if (gc->attr & GRID_ATTR_CHARSET)
+			ftc = FONT_NONE;
+			wide = 0;
+			if (i < n)
+			{
+				c = cp[i];
+				if (c == WCHAR_PADDING)
 				{
-					if (c >= '`' && c <= '~' && xt_font_pick(x, ft, c-('`'-1)) != FONT_TYPE_NONE)
-						c -= '`'-1;
-					else if (c < nitems(xtmux_acs) && xtmux_acs[c])
-						c = xtmux_acs[c];
+					/* drawn by the wide glyph before it, or blank */
+					if (covered)
+					{
+						covered = 0;
+						continue;
+					}
+					c = ' ';
 				}
-
-				ftc = xt_font_pick(x, ft, c);
-				if (ftc != FONT_TYPE_NONE && ftc != ftl)
+				wide = i+1 < n && cp[i+1] == WCHAR_PADDING;
+				if (c < 0x80 && !wide)
 				{
-					if (i == l)
-						ftl = ftc;
-					else
-						break;
+					ftc = low[c].font;
+					c = low[c].c;
 				}
-
-				c2[i].byte1 = c >> 8;
-				c2[i].byte2 = c;
+				else
+					ftc = xt_font_char(x, ft, charset, &c, wide);
+				/* anything goes, except a wide font for a narrow cell */
+				if (ftc == FONT_NONE && xt_font_wide(x, ftl))
+					ftc = ft;
 			}
 
-			XSetFont(x->display, x->gc, x->font[ftl].fid);
-			if (cleared && bg == x->bg)
-				XDrawString16(x->display, x->window, x->gc, C2X(cx+l), py + x->font[ftl].ascent, &c2[l], i-l);
+			if (i < n && (ftc == FONT_NONE || ftc == ftl))
+				;
+			else if (k > kl)
+			{
+#ifdef HAVE_XRENDER
+				if (x->picture != None)
+				{
+					/* collect the runs to draw all at once */
+					xt_render_load_glyphs(x, ftl, &cm[kl], k-kl);
+					elts[ne].glyphset = x->font[ftl]->glyphs;
+					elts[ne].chars = &cm[kl];
+					elts[ne].nchars = k-kl;
+					elts[ne].xOff = ne ? 0 : C2X(cx+l);
+					elts[ne].yOff = ne ? 0 : py;
+					ne ++;
+				}
+				else
+#endif
+#ifdef HAVE_XSHM
+				if (x->image)
+					xt_image_glyphs(x, ftl, C2X(cx+l), py, &c2[kl], k-kl, fg, bg);
+				else
+#endif
+				{
+					XSetFont(x->display, x->gc, x->font[ftl]->fid);
+					XSetBackground(x->display, x->gc, bg);
+					XDrawImageString16(x->display, x->draw, x->gc, C2X(cx+l), py + x->font[ftl]->ascent, &c2[kl], k-kl);
+				}
+				kl = k;
+				l = i;
+				ftl = ftc;
+			}
 			else
 			{
-				XSetBackground(x->display, x->gc, bg);
-				XDrawImageString16(x->display, x->window, x->gc, C2X(cx+l), py + x->font[ftl].ascent, &c2[l], i-l);
+				l = i;
+				ftl = ftc;
 			}
+			if (i == n)
+				break;
+
+			covered = wide && xt_font_wide(x, ftl);
+			c2[k].byte1 = c >> 8;
+			c2[k].byte2 = c;
+#ifdef HAVE_XRENDER
+			cm[k] = c;
+#endif
+			k ++;
+		}
 
-			ftl = ftc;
+#ifdef HAVE_XRENDER
+		if (ne)
+		{
+			xt_fill(x, bg, px, py, wx, hy);
+			XRenderCompositeText16(x->display, PictOpOver, xt_render_pen(x, fg), x->picture,
+					NULL, 0, 0, elts[0].xOff, elts[0].yOff, elts, ne);
 		}
+#endif
 	}
 
 	/* UNDERSCORE xor BLINK */
 	if ((gc->attr & (GRID_ATTR_UNDERSCORE | GRID_ATTR_BLINK)) == GRID_ATTR_UNDERSCORE ||
 			(gc->attr & (GRID_ATTR_UNDERSCORE | GRID_ATTR_BLINK)) == GRID_ATTR_BLINK)
 	{
-		u_int y = py + x->font[ft].ascent;
-		if (x->font[ft].descent > 1)
+		u_int y = py + x->font[ft]->ascent;
+		if (x->font[ft]->descent > 1)
 			y ++;
-		XSetForeground(x->display, x->gc, fg);
-		XDrawLine(x->display, x->window, x->gc,
-				px, y,
-				px + wx - 1, y);
+		xt_fill(x, fg, px, y, wx, 1);
 	}
 	if (gc->attr & GRID_ATTR_BLINK)
 	{
 		/* a little odd but blink is weird anyway */
-		XDrawLine(x->display, x->window, x->gc,
-				px, py,
-				px + wx - 1, py);
+		xt_fill(x, fg, px, py, wx, 1);
 	}
 }
 
-static void
-xt_draw_cells(struct xtmux *x, u_int cx, u_int cy, const wchar *c, size_t n, const struct grid_cell *ga)
-{
-	if (!n)
-		return;
-	xt_draw_chars(x, cx, cy, c, n, ga, !(x->cd && INSIDE(x->cx, x->cy, cx, cy, n, 1)));
-}
-
+/* draw all dirty cells */
 static int
-xt_putc_flush(struct xtmux *x)
+xt_draw_dirty(struct xtmux *x)
 {
-	struct putc *b = &x->putc_buf;
-	u_int n = b->n;
+	wchar cl[x->sx];
+	struct grid_cell gc = grid_default_cell;
+	struct span *d;
+	struct cell *row;
+	u_int y, l, i;
+	int r = 0;
 
-	if (!n)
-		return 0;
+	xt_scroll_flush(x);
+	for (y = 0; y < x->sy; y ++)
+	{
+		d = &x->dirty[y];
+		if (d->x1 >= d->x2)
+			continue;
 
-	b->n = 0;
-	xt_draw_chars(x, b->x, b->y, b->s, n, &b->cell, 0);
-	return 1;
+		row = xt_cell(x, 0, y);
+		/* keep wide characters together with their right halves */
+		if (d->x1 > 0 && row[d->x1].c == WCHAR_PADDING)
+			d->x1 --;
+		if (d->x2 < x->sx && row[d->x2].c == WCHAR_PADDING)
+			d->x2 ++;
+		for (l = d->x1; l < d->x2; l = i)
+		{
+			for (i = l; i < d->x2 && (!xt_cell_attr_cmp(&row[i], &row[l]) ||
+						(i > l && row[i].c == WCHAR_PADDING)); i ++)
+				cl[i] = row[i].c;
+			gc.flags = row[l].flags;
+			gc.attr = row[l].attr;
+			gc.fg = row[l].fg;
+			gc.bg = row[l].bg;
+			xt_draw_chars(x, l, y, &cl[l], i-l, &gc);
+		}
+		d->x1 = d->x2 = 0;
+		r = 1;
+	}
+	/* after the backgrounds of the box drawing queued */
+	xt_fills_flush(x);
+	return r;
 }
 
 static void
 xtmux_putwc(struct tty *tty, u_int c)
 {
 	struct xtmux *x = tty->xtmux;
-	struct putc *b = &x->putc_buf;
-
-	XENTRY();
 
 	if (tty->cx >= tty->sx)
 	{
@@ -1395,15 +3443,7 @@ xtmux_putwc(struct tty *tty, u_int c)
 			tty->cy ++;
 	}
 
-	if (!(b->n && b->n < PUTC_BUF_LEN && b->x+b->n == tty->cx && b->y == tty->cy && !grid_attr_cmp(&b->cell, &tty->cell))) {
-		xt_putc_flush(x);
-		b->x = tty->cx;
-		b->y = tty->cy;
-		memcpy(&b->cell, &tty->cell, sizeof tty->cell);
-	}
-	b->s[b->n++] = c;
-
-	XRETURN();
+	xt_put(x, tty->cx, tty->cy, c, &tty->cell);
 	xt_flush_timer(x);
 }
 
@@ -1417,9 +3457,17 @@ xtmux_putc(struct tty *tty, u_char c)
 void
 xtmux_pututf8(struct tty *tty, const struct utf8_data *gu)
 {
+	struct xtmux *x = tty->xtmux;
 	wchar_t c;
-	if (utf8_combine(gu, &c) == UTF8_DONE)
-		xtmux_putwc(tty, c);
+	u_int i;
+
+	if (utf8_combine(gu, &c) != UTF8_DONE)
+		c = WCHAR_REPLACEMENT;
+	xtmux_putwc(tty, c);
+	/* unlike tty_putc, tty_pututf8 leaves the cursor */
+	for (i = 1; i < gu->width; i ++)
+		xt_put(x, tty->cx + i, tty->cy, WCHAR_PADDING, &tty->cell);
+	tty->cx += gu->width;
 }
 
 void
@@ -1439,7 +3487,7 @@ xtmux_cmd_insertcharacter(struct tty *tty, const struct tty_ctx *ctx)
 			PANE_CX, PANE_CY,
 			ctx->num, 1);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1460,7 +3508,7 @@ xtmux_cmd_deletecharacter(struct tty *tty, const struct tty_ctx *ctx)
 			PANE_X(screen_size_x(s) - ctx->num), PANE_CY,
 			ctx->num, 1);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1477,7 +3525,7 @@ xtmux_cmd_insertline(struct tty *tty, const struct tty_ctx *ctx)
 			screen_size_x(s), ctx->orlower+1-ctx->ocy,
 			ctx->num);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1494,7 +3542,7 @@ xtmux_cmd_deleteline(struct tty *tty, const struct tty_ctx *ctx)
 			screen_size_x(s), ctx->orlower+1-ctx->ocy,
 			-ctx->num);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1510,7 +3558,7 @@ xtmux_cmd_clearline(struct tty *tty, const struct tty_ctx *ctx)
 			PANE_X(0), PANE_CY,
 			screen_size_x(s), 1);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1526,7 +3574,7 @@ xtmux_cmd_clearendofline(struct tty *tty, const struct tty_ctx *ctx)
 			PANE_CX, PANE_CY,
 			screen_size_x(s) - ctx->ocx, 1);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1541,7 +3589,7 @@ xtmux_cmd_clearstartofline(struct tty *tty, const struct tty_ctx *ctx)
 			PANE_X(0), PANE_CY,
 			ctx->ocx + 1, 1);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1559,7 +3607,7 @@ xtmux_cmd_reverseindex(struct tty *tty, const struct tty_ctx *ctx)
 			screen_size_x(s), ctx->orlower+1-ctx->orupper,
 			1);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1577,7 +3625,7 @@ xtmux_cmd_linefeed(struct tty *tty, const struct tty_ctx *ctx)
 			screen_size_x(s), ctx->orlower+1-ctx->orupper,
 			-1);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1594,7 +3642,7 @@ xtmux_cmd_scrollup(struct tty *tty, const struct tty_ctx *ctx)
 			screen_size_x(s), ctx->orlower+1-ctx->orupper,
 			-ctx->num);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1621,7 +3669,7 @@ xtmux_cmd_clearendofscreen(struct tty *tty, const struct tty_ctx *ctx)
 				PANE_X(0), PANE_Y(y),
 				screen_size_x(s), screen_size_y(s) - y);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1646,7 +3694,7 @@ xtmux_cmd_clearstartofscreen(struct tty *tty, const struct tty_ctx *ctx)
 				PANE_X(0), PANE_Y(0),
 				screen_size_x(s), y);
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1662,7 +3710,7 @@ xtmux_cmd_clearscreen(struct tty *tty, const struct tty_ctx *ctx)
 			PANE_X(0), PANE_Y(0),
 			screen_size_x(s), screen_size_y(s));
 
-	XUPDATE();
+	xt_flush_timer(x);
 	XRETURN();
 }
 
@@ -1677,20 +3725,61 @@ xtmux_cmd_setselection(struct tty *tty, const struct tty_ctx *ctx)
 	if (XGetSelectionOwner(x->display, XA_PRIMARY) != x->window)
 		XRETURN();
 
-	XChangeProperty(x->display, DefaultRootWindow(x->display),
-			XA_CUT_BUFFER0, XA_STRING, 8, PropModeReplace, ctx->ptr, ctx->num);
+	/* cut buffers cannot be sent in pieces */
+	if (ctx->num <= x->xd->selection_chunk)
+		XChangeProperty(x->display, DefaultRootWindow(x->display),
+				XA_CUT_BUFFER0, XA_STRING, 8, PropModeReplace, ctx->ptr, ctx->num);
 
 	XRETURN();
 }
 
+/* give a selection to a requestor, in pieces if it is too big for one request */
+static void
+xt_selection_send(struct xtmux *x, Window w, Atom property, Atom type, const char *data, size_t size)
+{
+	struct xdisplay *xd = x->xd;
+	struct incr *in;
+	long n;
+
+	if (size <= xd->selection_chunk)
+	{
+		XChangeProperty(x->display, w, property, type, 8, PropModeReplace,
+				(const unsigned char *)data, size);
+		return;
+	}
+
+	in = xcalloc(1, sizeof *in);
+	in->xd = xd;
+	evtimer_set(&in->timer, xdisplay_incr_callback, in);
+	in->requestor = w;
+	in->own = xdisplay_client(xd, w) != NULL;
+	in->property = property;
+	in->type = type;
+	in->data = xmalloc(size);
+	memcpy(in->data, data, size);
+	in->size = size;
+	LIST_INSERT_HEAD(&xd->incrs, in, entry);
+
+	/* pieces are sent from xdisplay_incr_event as the requestor deletes
+	 * each; our own windows already select these events */
+	if (!in->own)
+		XSelectInput(x->display, w, PropertyChangeMask | StructureNotifyMask);
+	xdisplay_incr_wait(in);
+	n = size;
+	XChangeProperty(x->display, w, property, xd->atom_incr, 32, PropModeReplace,
+			(unsigned char *)&n, 1);
+}
+
 static void
 xtmux_selection_request(struct tty *tty, XSelectionRequestEvent *xev)
 {
 	struct xtmux *x = tty->xtmux;
+	struct xdisplay *xd = x->xd;
 	XSelectionEvent r;
 	struct paste_buffer *pb;
 	const char *pbdata = NULL;
 	size_t pbsize;
+	Atom type;
 
 	if (xev->owner != x->window || xev->selection != XA_PRIMARY)
 		return;
@@ -1709,31 +3798,24 @@ xtmux_selection_request(struct tty *tty, XSelectionRequestEvent *xev)
 	if ((pb = paste_get_top(NULL)))
 		pbdata = paste_buffer_data(pb, &pbsize);
 
-	if (xev->target == XA_STRING)
+	if (xev->target == xd->atom_targets)
 	{
-		if (pbdata && XChangeProperty(x->display, r.requestor, xev->property,
-					XA_STRING, 8, PropModeReplace, pbdata, pbsize))
+		Atom targets[] = { xd->atom_utf8_string, XA_STRING, xd->atom_text, xd->atom_targets };
+
+		if (XChangeProperty(x->display, r.requestor, xev->property, XA_ATOM, 32, PropModeReplace,
+					(unsigned char *)targets, nitems(targets)))
 			r.property = xev->property;
 	}
-	else
+	else if (xev->target == XA_STRING || xev->target == xd->atom_utf8_string ||
+			xev->target == xd->atom_text)
 	{
-		char *target = XGetAtomName(x->display, xev->target);
-		if (!strcmp(target, "TARGETS"))
-		{
-			/* silly, but easy enough */
-			Atom targets[] = { XA_STRING, xev->target };
-
-			if (XChangeProperty(x->display, r.requestor, xev->property, XA_ATOM, 32, PropModeReplace,
-						(unsigned char *)targets, nitems(targets)))
-				r.property = xev->property;
-		}
-		else if (!strcmp(target, "TEXT"))
+		/* buffers are really UTF-8, but STRING has always had them as is */
+		type = xev->target == xd->atom_text ? XA_STRING : xev->target;
+		if (pbdata)
 		{
-			if (pbdata && XChangeProperty(x->display, r.requestor, xev->property,
-						XA_STRING, 8, PropModeReplace, pbdata, pbsize))
-				r.property = xev->property;
+			xt_selection_send(x, r.requestor, xev->property, type, pbdata, pbsize);
+			r.property = xev->property;
 		}
-		XFree(target);
 	}
 
 	XSendEvent(x->display, r.requestor, False, 0, (XEvent *)&r);
@@ -1748,29 +3830,68 @@ do_paste(const struct paste_ctx *p, const char *data, size_t size)
 	paste_send_pane(data, size, p->wp, p->sep, 0);
 }
 
-static int
-xt_paste_property(struct xtmux *x, Window w, Atom p)
+static void
+xt_paste_done(struct xtmux *x)
 {
-	XTextProperty t;
-
-	if (!XGetTextProperty(x->display, w, &t, p) || !t.value || t.format != 8)
-	{
-		fprintf(stderr, "could not get text property to paste\n");
-		return -1;
-	}
-
-	log_debug("pasting %lu characters", t.nitems);
-	do_paste(&x->paste, t.value, t.nitems);
-
 	x->paste.time = 0;
 	x->paste.wp = NULL;
+	x->paste.incr = 0;
 	free(x->paste.sep);
 	x->paste.sep = NULL;
-	XFree(t.value);
+}
+
+/* the pane being pasted into may have gone away while waiting */
+static int
+xt_paste_pane(struct xtmux *x)
+{
+	struct session		*s;
+	struct winlink		*wl;
+	struct window_pane	*wp;
+
+	RB_FOREACH(s, sessions, &sessions)
+		RB_FOREACH(wl, winlinks, &s->windows)
+			TAILQ_FOREACH(wp, &wl->window->panes, entry)
+				if (wp == x->paste.wp)
+					return 1;
 
+	log_debug("paste target pane disappeared");
+	xt_paste_done(x);
 	return 0;
 }
 
+/* paste a text property a piece at a time; returns how much there was, or -1 */
+static long
+xt_paste_property(struct xtmux *x, Window w, Atom p, Bool delete)
+{
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char *data;
+	long offset = 0, size = 0;
+
+	do {
+		/* deleted with the last piece */
+		if (XGetWindowProperty(x->display, w, p, offset, x->xd->selection_chunk / 4, delete,
+					AnyPropertyType, &type, &format, &n, &after, &data) != Success)
+			data = NULL;
+		if (!data || format != 8)
+		{
+			if (data)
+				XFree(data);
+			fprintf(stderr, "could not get text property to paste\n");
+			return -1;
+		}
+
+		do_paste(&x->paste, (const char *)data, n);
+		offset += n / 4;
+		size += n;
+		XFree(data);
+	} while (after);
+
+	log_debug("pasted %ld characters", size);
+	return size;
+}
+
 enum cmd_retval
 xtmux_paste(struct tty *tty, struct window_pane *wp, const char *which, const char *sep)
 {
@@ -1797,6 +3918,7 @@ xtmux_paste(struct tty *tty, struct window_pane *wp, const char *which, const ch
 
 	x->paste.time = x->last_time;
 	x->paste.wp = wp;
+	x->paste.incr = 0;
 	free(x->paste.sep);
 	if (sep)
 		x->paste.sep = xstrdup(sep);
@@ -1804,7 +3926,10 @@ xtmux_paste(struct tty *tty, struct window_pane *wp, const char *which, const ch
 		x->paste.sep = NULL;
 
 	if (s >= XA_CUT_BUFFER0 && s <= XA_CUT_BUFFER7) {
-		if (xt_paste_property(x, DefaultRootWindow(x->display), s))
+		long r = xt_paste_property(x, DefaultRootWindow(x->display), s, False);
+
+		xt_paste_done(x);
+		if (r < 0)
 			XRETURN(CMD_RETURN_ERROR);
 		XRETURN(CMD_RETURN_NORMAL);
 	}
@@ -1819,14 +3944,12 @@ xtmux_paste(struct tty *tty, struct window_pane *wp, const char *which, const ch
 			do_paste(&x->paste, data, size);
 		}
 
-		x->paste.time = 0;
-		x->paste.wp = NULL;
-		free(x->paste.sep);
-		x->paste.sep = NULL;
+		xt_paste_done(x);
 		XRETURN(CMD_RETURN_NORMAL);
 	}
 
-	if (XConvertSelection(x->display, s, XA_STRING, XA_STRING, x->window, x->paste.time))
+	x->paste.target = x->xd->atom_utf8_string;
+	if (XConvertSelection(x->display, s, x->paste.target, XA_STRING, x->window, x->paste.time))
 		XRETURN(CMD_RETURN_ERROR);
 	XRETURN(CMD_RETURN_NORMAL);
 }
@@ -1835,31 +3958,85 @@ static void
 xtmux_selection_notify(struct tty *tty, XSelectionEvent *xev)
 {
 	struct xtmux 		*x = tty->xtmux;
-	struct session		*s;
-	struct winlink		*wl;
-	struct window_pane	*wp;
+	Atom			type;
+	int			format;
+	unsigned long		n, after;
+	unsigned char		*data;
 
 	if (!(xev->requestor == x->window &&
 				x->paste.wp &&
+				!x->paste.incr &&
 				xev->time == x->paste.time &&
-				xev->target == XA_STRING &&
-				xev->property == XA_STRING))
+				xev->target == x->paste.target))
 		return;
 
-	/* need to make sure pane is still valid */
-	RB_FOREACH(s, sessions, &sessions)
-		RB_FOREACH(wl, winlinks, &s->windows)
-			TAILQ_FOREACH(wp, &wl->window->panes, entry)
-				if (wp == x->paste.wp)
-					goto found;
+	/* older owners may only have STRING */
+	if (xev->property == None && xev->target == x->xd->atom_utf8_string)
+	{
+		x->paste.target = XA_STRING;
+		XConvertSelection(x->display, xev->selection, x->paste.target, XA_STRING,
+				x->window, x->paste.time);
+		return;
+	}
+	if (xev->property != XA_STRING)
+		return;
 
-	log_debug("paste target pane disappeared");
-	x->paste.wp = NULL;
-	return;
+	if (!xt_paste_pane(x))
+		return;
+
+	/* too big for one property, so the owner will send it in pieces as
+	 * each is deleted, starting with this one */
+	if (XGetWindowProperty(x->display, x->window, xev->property, 0, 0, False,
+				AnyPropertyType, &type, &format, &n, &after, &data) == Success)
+	{
+		if (data)
+			XFree(data);
+		if (type == x->xd->atom_incr)
+		{
+			x->paste.incr = 1;
+			XDeleteProperty(x->display, x->window, xev->property);
+			return;
+		}
+	}
+
+	xt_paste_property(x, x->window, xev->property, True);
+	xt_paste_done(x);
+}
+
+/* the next piece of an INCR selection */
+static void
+xtmux_property_notify(struct tty *tty, XPropertyEvent *xev)
+{
+	struct xtmux *x = tty->xtmux;
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char *data;
+
+	if (!x->paste.incr || xev->atom != XA_STRING || xev->state != PropertyNewValue)
+		return;
+
+	if (!xt_paste_pane(x))
+		return;
 
-found:
-	if (xt_paste_property(x, xev->requestor, xev->property) == 0)
-		XDeleteProperty(x->display, xev->requestor, xev->property);
+	/* an empty piece is the end */
+	if (XGetWindowProperty(x->display, x->window, xev->atom, 0, 0, False,
+				AnyPropertyType, &type, &format, &n, &after, &data) != Success)
+	{
+		xt_paste_done(x);
+		return;
+	}
+	if (data)
+		XFree(data);
+	if (!after)
+	{
+		XDeleteProperty(x->display, x->window, xev->atom);
+		xt_paste_done(x);
+		return;
+	}
+
+	if (xt_paste_property(x, x->window, xev->atom, True) < 0)
+		xt_paste_done(x);
 }
 
 void
@@ -1873,31 +4050,37 @@ xtmux_bell(struct tty *tty)
 	XRETURN();
 }
 
+/* copy columns [left, right) of a screen line into cells at atx,aty */
 static void
 xt_draw_line(struct xtmux *x, struct screen *s, u_int py, u_int left, u_int right, u_int atx, u_int aty)
 {
 	struct grid_line *gl = grid_get_line(s->grid, s->grid->hsize+py);
-	struct grid_cell ga = grid_default_cell;
-	wchar cl[right-left];
-	u_int bx = left;
-	u_int sx = right;
-	u_int px;
+	struct cell *cl;
+	u_int sx, px, x1 = right, x2 = left;
+
+	if (atx >= x->sx || aty >= x->sy || left >= right)
+		return;
+	if (right - left > x->sx - atx)
+		right = left + x->sx - atx;
 
+	sx = right;
 	if (sx > gl->cellsize)
 		sx = gl->cellsize;
-	for (px = bx; px < sx; px ++)
+	cl = xt_cell(x, atx, aty);
+	for (px = left; px < sx; px ++, cl ++)
 	{
 		struct grid_cell_entry *gce = &gl->celldata[px];
 		struct grid_cell gc;
+		wchar c;
 
 		if (gce->flags & GRID_FLAG_EXTENDED) {
 			if (gce->offset >= gl->extdsize) {
 				gc = grid_default_cell;
-				cl[px-left] = ' ';
+				c = ' ';
 			}
 			else {
 				gc = gl->extddata[gce->offset];
-				cl[px-left] = grid_char(&gc);
+				c = grid_char(&gc);
 			}
 		} else {
 			gc.flags = gce->flags;
@@ -1910,7 +4093,7 @@ xt_draw_line(struct xtmux *x, struct screen *s, u_int py, u_int left, u_int righ
 			if (gc.flags & GRID_FLAG_BG256)
 				gc.bg |= COLOUR_FLAG_256;
 			gc.flags &= ~GRID_FLAG_BG256;
-			cl[px-left] = gce->data.data;
+			c = gce->data.data;
 		}
 
 		if (gc.flags & GRID_FLAG_SELECTED) {
@@ -1918,15 +4101,25 @@ xt_draw_line(struct xtmux *x, struct screen *s, u_int py, u_int left, u_int righ
 			screen_select_cell(s, &gc, &sel);
 		}
 
-		if (px == bx || grid_attr_cmp(&gc, &ga))
+		if (xt_set_cell(cl, c, &gc))
 		{
-			xt_draw_cells(x, atx+bx-left, aty, &cl[bx-left], px-bx, &ga);
-			bx = px;
-			ga = gc;
+			if (px < x1)
+				x1 = px;
+			x2 = px+1;
 		}
 	}
-	xt_draw_cells(x, atx+bx-left, aty, &cl[bx-left], px-bx, &ga);
-	/* XXX do we need to clear from px to right? */
+	for (; px < right; px ++, cl ++)
+		if (xt_set_cell(cl, ' ', &grid_default_cell))
+		{
+			if (px < x1)
+				x1 = px;
+			x2 = px+1;
+		}
+
+	/* only what differs from what is on screen, so redrawing a whole
+	 * window that has not changed draws nothing */
+	if (x1 < x2)
+		xt_dirty(x, atx + x1-left, aty, x2-x1, 1);
 }
 
 void
@@ -1935,110 +4128,83 @@ xtmux_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 	struct xtmux *x = tty->xtmux;
 	u_int sx;
 
-	XENTRY();
-
 	sx = screen_size_x(s);
-	if (sx > tty->sx)
-		sx = tty->sx;
-	if (nx > sx)
-		nx = sx;
-
-	if (xt_clear(x, atx, aty, nx, 1))
-	{
-		xt_draw_line(x, s, py, px, nx, atx, aty);
-		XUPDATE();
-	}
+	if (px >= sx)
+		return;
+	if (nx > sx - px)
+		nx = sx - px;
 
-	XRETURN();
+	xt_draw_line(x, s, py, px, px+nx, atx, aty);
+	xt_flush_timer(x);
 }
 
+/* tools/xtmux-bench.sh counts these: the requests are those on the whole
+ * display since the last frame drawn on it, so include any other windows'
+ * and selection traffic */
 static void
-xtmux_redraw_pane(struct tty *tty, struct window_pane *wp, int yoff, int left, int top, int right, int bot)
+xt_frame_log(struct tty *tty)
 {
 	struct xtmux *x = tty->xtmux;
-	struct screen *s = wp->screen;
-	u_int y;
-
-	yoff += wp->yoff;
-	left -= wp->xoff;
-	if (left < 0)
-		left = 0;
-	else if ((u_int)left >= wp->sx)
-		return;
-	right -= wp->xoff;
-	if (right <= 0)
-		return;
-	else if ((u_int)right > wp->sx)
-		right = wp->sx;
-	top -= yoff;
-	if (top < 0)
-		top = 0;
-	bot -= yoff;
-	if (bot <= 0)
-		return;
-	if ((u_int)bot > wp->sy)
-		bot = wp->sy;
 
-	for (y = top; y < (u_int)bot; y ++)
-		xt_draw_line(x, s, y, left, right, wp->xoff+left, yoff+y);
+	log_debug("%s: frame of %lu requests", tty->client->name,
+			NextRequest(x->display) - x->xd->frame_request);
+	x->xd->frame_request = NextRequest(x->display);
 }
 
-/* much like screen_redraw_screen, should possibly replace it */
 static void
-xtmux_redraw(struct client *c, int left, int top, int right, int bot)
+xtmux_flush_callback(__unused int fd, __unused short events, void *data)
 {
-	struct tty *tty = &c->tty;
-	struct window_pane *wp;
-	u_int yoff = 0;
-	struct window_pane swp; /* fake status pane */
-
-	if (!c->session)
-		return;
-
-	swp.screen = &c->status.screen;
-	swp.sx = swp.screen->grid->sx;
-
-	if (c->flags & CLIENT_STATUSOFF)
-		swp.sy = 0;
-	else
-		swp.sy = status_line_size(c);
-	if (c->message_string || c->prompt_string)
-		swp.sy = swp.sy ?: 1;
+	struct tty *tty = (struct tty *)data;
+	struct xtmux *x = tty->xtmux;
+	int r = 0;
 
-	swp.xoff = 0;
-	if (options_get_number(c->session->options, "status-position")) {
-		yoff = 0;
-		swp.yoff = tty->sy-swp.sy;
-	} else {
-		yoff = swp.sy;
-		swp.yoff = 0;
+	XENTRY();
+	r = xt_draw_dirty(x);
+	r |= xt_update_cursor(tty);
+	r |= xt_buffer_flush(x);
+	if (r)
+	{
+		gettimeofday(&x->last_frame, NULL);
+		xt_frame_log(tty);
+		XUPDATE();
 	}
-	if (swp.sy)
-		xtmux_redraw_pane(tty, &swp, 0, left, top, right, bot);
+	XRETURN_();
+	x->flush = 0;
+}
 
-	TAILQ_FOREACH(wp, &c->session->curw->window->panes, entry)
-		xtmux_redraw_pane(tty, wp, yoff, left, top, right, bot);
+/* the cursor is toggled on its own, leaving any cells to be drawn for the next frame */
+static void
+xtmux_blink_callback(__unused int fd, __unused short events, void *data)
+{
+	struct tty *tty = (struct tty *)data;
+	struct xtmux *x = tty->xtmux;
 
-	/* TODO: borders, numbers */
+	x->blink_off = !x->blink_off;
+	/* or with the frame, if one is coming */
+	if (evtimer_pending(&x->flush_timer, NULL))
+		return;
 
-	if (INSIDE(tty->cx, tty->cy, left, top, right-left, bot-top))
-		xt_update_cursor(tty);
+	XENTRY();
+	xt_update_cursor(tty);
+	if (xt_buffer_flush(x))
+	{
+		xt_frame_log(tty);
+		XUPDATE();
+	}
+	XRETURN_();
 }
 
 static void
-xtmux_flush_callback(__unused int fd, __unused short events, void *data)
+xtmux_style_callback(__unused int fd, __unused short events, void *data)
 {
 	struct tty *tty = (struct tty *)data;
 	struct xtmux *x = tty->xtmux;
-	int r = 0;
+	u_int ft;
 
 	XENTRY();
-	r = xt_putc_flush(x);
-	r |= xt_update_cursor(tty);
-	if (r)
-		XUPDATE();
+	for (ft = FONT_TYPE_BOLD; ft < FONT_TYPE_COUNT; ft ++)
+		xt_style_font(x, ft);
 	XRETURN_();
-	x->flush = 0;
 }
 
 static void
@@ -2235,44 +4401,150 @@ xtmux_configure_notify(struct tty *tty, XConfigureEvent *xev)
 	u_int sx = xev->width  / x->cw;
 	u_int sy = xev->height / x->ch;
 
+	if (x->buffer != None)
+		xt_buffer_resize(x, xev->width, xev->height);
+#ifdef HAVE_XSHM
+	if (x->image && !xt_shm_resize(x, xev->width, xev->height))
+	{
+		/* draw on the server from now on */
+		xt_shm_free(x);
+		xt_buffer_setup(tty);
+#ifdef HAVE_XRENDER
+		xt_render_setup(tty);
+#endif
+		XClearArea(x->display, x->window, 0, 0, 0, 0, True);
+	}
+#endif
 	if (sx != tty->sx || sy != tty->sy)
 	{
 		tty_set_size(tty, sx, sy);
+		xt_cells_resize(x, sx, sy);
 		xtmux_cursor(tty, 0, 0);
 		recalculate_sizes();
 	}
 }
 
+static void
+xt_expose_cells(struct xtmux *x, const XRectangle *r)
+{
+	int cx1, cy1, cx2, cy2;
+
+	cx1 = r->x / x->cw;
+	cy1 = r->y / x->ch;
+	cx2 = (r->x + r->width + x->cw - 1) / x->cw;
+	cy2 = (r->y + r->height + x->ch - 1) / x->ch;
+
+	/* the cursor may have been partially cleared */
+	if (x->cd && INSIDE(x->cx, x->cy, cx1, cy1, cx2-cx1, cy2-cy1))
+		x->cd = 0;
+
+	/* whole cells are drawn, so this covers any partially exposed ones */
+	xt_dirty(x, cx1, cy1, cx2-cx1, cy2-cy1);
+}
+
 static void
 xt_expose(struct xtmux *x, XExposeEvent *xev)
 {
-	int px1 = xev->x;
-	int py1 = xev->y;
-	int cx1 = px1 / x->cw;
-	int cy1 = py1 / x->ch;
-	int px2 = px1 + xev->width;
-	int py2 = py1 + xev->height;
-	int cx2 = (px2 + x->cw  - 1) / x->cw;
-	int cy2 = (py2 + x->ch - 1) / x->ch;
+	XRectangle r, *e;
+	Region rgn, src, moved, all;
+	struct copy sc;
+	u_int i, y1, y2, h;
+	int right, bottom;
 
-	if (xev->type == GraphicsExpose && !xev->count && x->copy_active)
-		x->copy_active --;
+	/* the last GraphicsExpose of a copy is the end of it */
+	xt_copy_done(x, xev->serial, xev->type == Expose || !xev->count);
+
+	r.x = xev->x;
+	r.y = xev->y;
+	r.width = xev->width;
+	r.height = xev->height;
+
+	if (xt_buffered(x))
+	{
+		/* everything is already in the buffer */
+		xt_damage(x, r.x, r.y, r.width, r.height);
+		return;
+	}
+
+	/* collect the series, which may be dozens of small pieces, and handle
+	 * it all at once when count says the last one has arrived */
+	if (x->nexposed == XTMUX_EXPOSE_RECTS)
+	{
+		e = &x->exposed[0];
+		for (i = 1; i < x->nexposed; i ++)
+		{
+			XRectangle *o = &x->exposed[i];
+
+			right = e->x + e->width;
+			if (o->x + o->width > right)
+				right = o->x + o->width;
+			bottom = e->y + e->height;
+			if (o->y + o->height > bottom)
+				bottom = o->y + o->height;
+			if (o->x < e->x)
+				e->x = o->x;
+			if (o->y < e->y)
+				e->y = o->y;
+			e->width = right - e->x;
+			e->height = bottom - e->y;
+		}
+		x->nexposed = 1;
+	}
+	x->exposed[x->nexposed++] = r;
+	if (xev->count)
+		return;
 
-	xt_write(x, cx1, cy1, cx2-cx1, cy2-cy1, 1);
+	/* copies the server did after this, and the one pending for scrolls,
+	 * may have moved the exposed area */
+	sc.serial = xev->serial + 1;
+	if (xt_scroll_copy(x, &y1, &y2, &h))
+	{
+		sc.src.x = C2X(x->scroll.x);
+		sc.src.y = C2Y(y1);
+		sc.src.width = C2W(x->scroll.w);
+		sc.src.height = C2H(h);
+		sc.dx = 0;
+		sc.dy = C2Y(y2) - C2Y(y1);
+	}
+	else
+		sc.src.width = sc.src.height = 0;
+	if (x->copy_count || sc.src.height)
+	{
+		rgn = XCreateRegion();
+		src = XCreateRegion();
+		moved = XCreateRegion();
+		all = XCreateRegion();
+		for (i = 0; i < x->nexposed; i ++)
+			XUnionRectWithRegion(&x->exposed[i], rgn, rgn);
+		for (i = 0; i <= x->copy_count; i ++)
+		{
+			struct copy *c = i < x->copy_count ? xt_copy_queued(x, i) : &sc;
+
+			if (!SERIAL_AFTER(c->serial, xev->serial))
+				continue;
+			XSubtractRegion(src, src, src);
+			XUnionRectWithRegion(&c->src, src, src);
+			XIntersectRegion(rgn, src, moved);
+			XOffsetRegion(moved, c->dx, c->dy);
+			XUnionRegion(rgn, moved, rgn);
+			XUnionRegion(all, moved, all);
+		}
+		/* the pieces themselves are still dirtied one by one below */
+		if (!XEmptyRegion(all))
+		{
+			XClipBox(all, &r);
+			xt_expose_cells(x, &r);
+		}
+		XDestroyRegion(all);
+		XDestroyRegion(moved);
+		XDestroyRegion(src);
+		XDestroyRegion(rgn);
+	}
 
-	/* extend exposed area out to character borders so we can redraw */
-	#define CLEAR(X1, X2, Y1, Y2) \
-		XClearArea(x->display, x->window, X1, Y1, (X2)-(X1), (Y2)-(Y1), False)
-	if  	     (C2X(cx1) < px1)
-		CLEAR(C2X(cx1),  px1, C2Y(cy1), C2Y(cy2));
-	if                           (C2Y(cy1) < py1)
-		CLEAR(px1,  C2X(cx2), C2Y(cy1),  py1);
-	if           (px2 < C2X(cx2))
-		CLEAR(px2,  C2X(cx2), py1,  C2Y(cy2));
-	if                           (py2 < C2Y(cy2))
-		CLEAR(px1,  px2,      py2,  C2Y(cy2));
-	#undef CLEAR
-	xtmux_redraw(x->client, cx1, cy1, cx2, cy2);
+	for (i = 0; i < x->nexposed; i ++)
+		xt_expose_cells(x, &x->exposed[i]);
+	x->nexposed = 0;
+	x->expose = 1;
 }
 
 static void
@@ -2298,97 +4570,154 @@ xtmux_focus(struct tty *tty, int focus)
 	xt_flush_timer(x);
 }
 
+/* draw right away if a key was pressed */
 static void
-xtmux_main(struct tty *tty)
+xtmux_flush(struct tty *tty)
 {
 	struct xtmux *x = tty->xtmux;
 
 	if (x->flush) {
-		xt_putc_flush(x);
-		xt_update_cursor(tty);
+		if (xt_draw_dirty(x) | xt_update_cursor(tty))
+			x->drawn = 1;
 		evtimer_del(&x->flush_timer);
 		x->flush = 0;
 	}
+}
+
+/* nothing is drawn while the window cannot be seen, and all of it once it can */
+static void
+xt_dormant(struct tty *tty)
+{
+	struct xtmux *x = tty->xtmux;
+
+	if (x->unmapped || x->obscured)
+		tty->flags |= TTY_UNMAPPED;
+	else if (tty->flags & TTY_UNMAPPED)
+	{
+		tty->flags &= ~TTY_UNMAPPED;
+		server_redraw_client(tty->client);
+	}
+}
+
+/* handle the motion kept back by xtmux_event */
+static void
+xt_motion_flush(struct tty *tty)
+{
+	struct xtmux *x = tty->xtmux;
+
+	if (!x->motion_pending)
+		return;
+	x->motion_pending = 0;
+	/* XMotionEvent looks enough like XButtonEvent */
+	xtmux_button_press(tty, (XButtonEvent *)&x->motion);
+}
+
+static void
+xtmux_event(struct tty *tty, XEvent *xev)
+{
+	struct xtmux *x = tty->xtmux;
+
+	/* anything else the user did comes after the motion */
+	if (xev->type == KeyPress || xev->type == ButtonPress || xev->type == ButtonRelease)
+		xt_motion_flush(tty);
 
-	while (XPending(x->display))
+	switch (xev->type)
 	{
-		XEvent xev;
-		XNextEvent(x->display, &xev);
+		case KeyPress:
+			x->flush = 1;
+			x->last_time = xev->xkey.time;
+			xtmux_key_press(tty, &xev->xkey);
+			break;
 
-		switch (xev.type)
-		{
-			case KeyPress:
-				x->flush = 1;
-				x->last_time = xev.xkey.time;
-				xtmux_key_press(tty, &xev.xkey);
-				break;
+		case ButtonPress:
+		case ButtonRelease:
+			x->last_time = xev->xbutton.time;
+			xtmux_button_press(tty, &xev->xbutton);
+			break;
 
-			case ButtonPress:
-			case ButtonRelease:
-			case MotionNotify: /* XMotionEvent looks enough like XButtonEvent */
-				x->last_time = xev.xbutton.time;
-				xtmux_button_press(tty, &xev.xbutton);
-				break;
+		case MotionNotify:
+			/* only the latest position of each pass is used */
+			x->last_time = xev->xmotion.time;
+			x->motion = xev->xmotion;
+			x->motion_pending = 1;
+			break;
 
-			case NoExpose:
-				if (xev.xnoexpose.drawable == x->window && x->copy_active)
-					x->copy_active --;
-				break;
+		case NoExpose:
+			xt_copy_done(x, xev->xnoexpose.serial, 1);
+			break;
 
-			case GraphicsExpose:
-			case Expose:
-				if (xev.xexpose.window == x->window)
-					xt_expose(x, &xev.xexpose);
-				break;
+		case GraphicsExpose:
+		case Expose:
+			xt_expose(x, &xev->xexpose);
+			break;
 
-			case FocusIn:
-			case FocusOut:
-				if (xev.xfocus.window == x->window)
-					xtmux_focus(tty, xev.type == FocusIn);
-				break;
+		case FocusIn:
+		case FocusOut:
+			xtmux_focus(tty, xev->type == FocusIn);
+			break;
 
-			case UnmapNotify:
-				if (xev.xunmap.window == x->window)
-					tty->flags |= TTY_UNMAPPED;
-				break;
+		case UnmapNotify:
+		case MapNotify:
+			x->unmapped = xev->type == UnmapNotify;
+			xt_dormant(tty);
+			break;
 
-			case MapNotify:
-				if (xev.xmap.window == x->window)
-					tty->flags &= ~TTY_UNMAPPED;
-				break;
+		case VisibilityNotify:
+			x->obscured = xev->xvisibility.state == VisibilityFullyObscured;
+			xt_dormant(tty);
+			break;
 
-			case ConfigureNotify:
-				if (xev.xconfigure.window != x->window)
-					break;
-				while (XCheckTypedWindowEvent(x->display, x->window, ConfigureNotify, &xev));
-				xtmux_configure_notify(tty, &xev.xconfigure);
-				break;
+		case ConfigureNotify:
+			while (XCheckTypedWindowEvent(x->display, x->window, ConfigureNotify, xev));
+			xtmux_configure_notify(tty, &xev->xconfigure);
+			break;
 
-			case MappingNotify:
-				XRefreshKeyboardMapping(&xev.xmapping);
-				break;
+		case SelectionClear:
+			x->last_time = xev->xselectionclear.time;
+			/* could do paste_free_top or something, but probably shouldn't.
+			 * might want to visually indicate X selection some other way, though */
+			break;
 
-			case SelectionClear:
-				x->last_time = xev.xselectionclear.time;
-				/* could do paste_free_top or something, but probably shouldn't.
-				 * might want to visually indicate X selection some other way, though */
-				break;
+		case SelectionRequest:
+			xtmux_selection_request(tty, &xev->xselectionrequest);
+			break;
 
-			case SelectionRequest:
-				xtmux_selection_request(tty, &xev.xselectionrequest);
-				break;
+		case SelectionNotify:
+			xtmux_selection_notify(tty, &xev->xselection);
+			break;
 
-			case SelectionNotify:
-				xtmux_selection_notify(tty, &xev.xselection);
-				break;
+		case PropertyNotify:
+			xtmux_property_notify(tty, &xev->xproperty);
+			break;
 
-			case DestroyNotify:
-				if (xev.xdestroywindow.window == x->window)
-					tty->client->flags |= CLIENT_EXIT;
-				break;
+		case DestroyNotify:
+			tty->client->flags |= CLIENT_EXIT;
+			break;
 
-			default:
-				fprintf(stderr, "unhandled x event %d\n", xev.type);
-		}
+		default:
+			fprintf(stderr, "unhandled x event %d\n", xev->type);
+	}
+}
+
+/* finish up after processing events */
+static void
+xtmux_main(struct tty *tty)
+{
+	struct xtmux *x = tty->xtmux;
+
+	xt_motion_flush(tty);
+
+	if (x->expose)
+	{
+		x->expose = 0;
+		if (xt_draw_dirty(x) | xt_update_cursor(tty))
+			x->drawn = 1;
+	}
+
+	if (xt_buffer_flush(x) || x->drawn)
+	{
+		x->drawn = 0;
+		xt_frame_log(tty);
+		XFlush(x->display);
 	}
 }